@@ -0,0 +1,338 @@
+// End-to-end shared-key latency benchmark. Loads the Cantor and Madromys
+// keymaps built against host/sim, joins them through a simulated relay that
+// forwards like host/relay.c, and replays scripted press/release traces on
+// shared keys. For each scenario it reports how long a change takes to take
+// effect on the other device, and the raw HID traffic it costs.
+//
+//     bench [-n events] [-s seed] [-c cantor_scan_us] [-m madromys_scan_us] [-r relay_us] cantor.so madromys.so
+//
+// Timing model: each device runs its main loop every scan_us. IN reports reach
+// the host on the next 1 ms USB frame, the relay takes relay_us, OUT reports
+// go out on the following frame and are handled by the device's next scan.
+// Latency runs from the switch changing to the effect being visible.
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "raw_hid_commands.h"
+#include "shared_keys.h"
+#include "sim/sim.h"
+
+#define REPORT_SIZE 32
+#define USB_FRAME_US 1000
+#define HEARTBEAT_US 500000
+#define WARMUP_US 500000
+#define MAX_PACKETS 64
+#define NOT_PENDING UINT32_MAX
+
+enum { CANTOR, MADROMYS, DEVICE_COUNT };
+
+typedef struct {
+    uint32_t time;
+    uint8_t  target;
+    uint8_t  data[REPORT_SIZE];
+} packet_t;
+
+typedef struct {
+    const char *name;
+    uint8_t     relay_version; // heartbeat version the relay advertises
+    uint8_t     source;
+    uint8_t     row;
+    uint8_t     cols[2];
+    uint8_t     key_count;
+    // Number of the scenario's shared keys in effect on the other device.
+    uint8_t (*active)(void);
+} scenario_t;
+
+typedef struct {
+    uint32_t packets;
+    uint32_t payload_bytes;
+    uint32_t heartbeats;
+    uint32_t events;
+    uint32_t missed;
+    uint32_t latency_count;
+    uint32_t *latency_us;
+} results_t;
+
+static const char  *paths[DEVICE_COUNT];
+static sim_device_t devices[DEVICE_COUNT];
+static uint32_t     scan_us[DEVICE_COUNT] = {250, 250};
+static uint32_t     next_scan[DEVICE_COUNT];
+static uint32_t     relay_us = 50;
+static bool (*drag_scroll)(void);
+
+static packet_t  packets[MAX_PACKETS];
+static uint8_t   packet_count;
+static uint32_t  now;
+static uint32_t  next_heartbeat;
+static bool      counting;
+static results_t results;
+
+// The event being timed: the target shows expected active keys.
+static const scenario_t *current;
+static uint8_t           expected;
+static uint32_t          pending_since;
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static uint32_t next_frame(uint32_t time) {
+    return (time + USB_FRAME_US - 1) / USB_FRAME_US * USB_FRAME_US;
+}
+
+// Relay
+
+static uint32_t payload_size(const uint8_t *data) {
+    if (data[0] == RAW_HID_CMD_SHARED_KEYS_FRAME) {
+        return offsetof(shared_keys_frame_t, data) + ((const shared_keys_frame_t *)data)->count;
+    }
+    return 5;
+}
+
+static void packet_queue(uint32_t time, uint8_t target, const uint8_t *data) {
+    if (packet_count == MAX_PACKETS) {
+        fprintf(stderr, "packet queue full\n");
+        exit(1);
+    }
+    packet_t *packet = &packets[packet_count++];
+    packet->time     = time;
+    packet->target   = target;
+    memcpy(packet->data, data, REPORT_SIZE);
+}
+
+// Device to host, arriving with the next USB frame. Legacy snapshots go on as
+// 0xC1, frames unchanged.
+static void device_raw_hid_send(void *context, const uint8_t *data, uint8_t length) {
+    uint8_t source = (uintptr_t)context;
+    uint8_t report[REPORT_SIZE];
+    memcpy(report, data, REPORT_SIZE);
+    if (report[0] == RAW_HID_CMD_HEARTBEAT) {
+        report[0] = RAW_HID_CMD_SHARED_KEYS;
+    } else if (report[0] != RAW_HID_CMD_SHARED_KEYS_FRAME) {
+        return;
+    }
+    if (counting) {
+        results.packets += 2; // in from the source, out to the other device
+        results.payload_bytes += 2 * payload_size(report);
+    }
+    packet_queue(next_frame(next_frame(now) + relay_us), source == CANTOR ? MADROMYS : CANTOR, report);
+}
+
+static void heartbeat_send(uint8_t version) {
+    uint8_t report[REPORT_SIZE] = {RAW_HID_CMD_HEARTBEAT, version};
+    for (uint8_t i = 0; i < DEVICE_COUNT; i++) {
+        packet_queue(next_frame(now), i, report);
+    }
+    if (counting) {
+        results.heartbeats += DEVICE_COUNT;
+    }
+}
+
+// Scenarios
+
+static uint8_t cantor_layer_active(uint8_t layer) {
+    return (devices[CANTOR].layer_state() >> layer) & 1;
+}
+
+// Layer indices from the Cantor keymap's enum layers.
+static uint8_t cantor_nav_layer(void) {
+    return cantor_layer_active(3); // _NAV_L_LAYER
+}
+
+static uint8_t cantor_fun_sym_layers(void) {
+    return cantor_layer_active(7) + cantor_layer_active(4); // _FUN_LAYER, _SYM_L_LAYER
+}
+
+static uint8_t madromys_drag_scroll(void) {
+    return drag_scroll();
+}
+
+// Positions from the keymaps: SK_LY(_SK_FUN), SK_LY(_SK_SYM) and SK_LY(_SK_NAV)
+// are Madromys buttons 1-3, SK_DS is the Cantor's top left key.
+static const scenario_t scenarios[] = {
+    {"madromys SK_LY(_SK_NAV) -> cantor layer", 2, MADROMYS, 0, {3}, 1, cantor_nav_layer},
+    {"madromys FUN+SYM chord -> cantor layers", 2, MADROMYS, 0, {1, 2}, 2, cantor_fun_sym_layers},
+    {"cantor SK_DS -> madromys drag scroll", 2, CANTOR, 0, {0}, 1, madromys_drag_scroll},
+    {"madromys SK_LY(_SK_NAV), legacy relay", 0, MADROMYS, 0, {3}, 1, cantor_nav_layer},
+    {"cantor SK_DS, legacy relay", 0, CANTOR, 0, {0}, 1, madromys_drag_scroll},
+};
+
+static void devices_load(void) {
+    for (uint8_t i = 0; i < DEVICE_COUNT; i++) {
+        if (!sim_load(&devices[i], paths[i])) {
+            exit(1);
+        }
+        sim_host_t host = {
+            .context         = (void *)(uintptr_t)i,
+            .raw_hid_send    = device_raw_hid_send,
+            .usb_interval_us = USB_FRAME_US,
+        };
+        devices[i].init(&host, 0);
+        next_scan[i] = i * scan_us[i] / 3; // scans out of phase
+    }
+    drag_scroll = (bool (*)(void))sim_symbol(&devices[MADROMYS], "sim_drag_scroll");
+    if (!drag_scroll) {
+        fprintf(stderr, "%s: no sim_drag_scroll\n", paths[MADROMYS]);
+        exit(1);
+    }
+}
+
+static void devices_unload(void) {
+    for (uint8_t i = 0; i < DEVICE_COUNT; i++) {
+        sim_unload(&devices[i]);
+    }
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void effect_check(void) {
+    if (pending_since != NOT_PENDING && current->active() == expected) {
+        results.latency_us[results.latency_count++] = now - pending_since;
+        pending_since                              = NOT_PENDING;
+    }
+}
+
+// One main loop pass, after handling the OUT reports that arrived since the
+// previous one.
+static void device_scan(uint8_t i) {
+    devices[i].set_time(now);
+    for (uint8_t p = 0; p < packet_count;) {
+        if (packets[p].target == i && packets[p].time <= now) {
+            packet_t packet = packets[p];
+            memmove(&packets[p], &packets[p + 1], (packet_count - p - 1) * sizeof(packet_t));
+            packet_count--;
+            devices[i].raw_hid_receive(packet.data, REPORT_SIZE);
+        } else {
+            p++;
+        }
+    }
+    devices[i].scan();
+    next_scan[i] += scan_us[i];
+    if (i != current->source) {
+        effect_check();
+    }
+}
+
+// Runs every scan and heartbeat due before until.
+static void run_until(uint32_t until) {
+    while (true) {
+        uint32_t next = next_heartbeat;
+        for (uint8_t i = 0; i < DEVICE_COUNT; i++) {
+            if (next_scan[i] < next) {
+                next = next_scan[i];
+            }
+        }
+        if (next >= until) {
+            break;
+        }
+        now = next;
+        if (now == next_heartbeat) {
+            heartbeat_send(current->relay_version);
+            next_heartbeat += HEARTBEAT_US;
+        }
+        for (uint8_t i = 0; i < DEVICE_COUNT; i++) {
+            if (next_scan[i] == now) {
+                device_scan(i);
+            }
+        }
+    }
+    now = until;
+}
+
+static void scenario_run(const scenario_t *scenario, uint32_t events) {
+    free(results.latency_us);
+    memset(&results, 0, sizeof(results));
+    results.latency_us = calloc(events * 2, sizeof(uint32_t));
+    current            = scenario;
+    pending_since      = NOT_PENDING;
+    now                = 0;
+    next_heartbeat     = 0;
+    packet_count       = 0;
+    counting           = false;
+    devices_load();
+    run_until(WARMUP_US);
+    counting = true;
+
+    uint32_t time = WARMUP_US;
+    for (uint32_t i = 0; i < events * 2; i++) {
+        bool pressed = (i & 1) == 0;
+        // Gaps of 100-200 ms and holds of 50-100 ms, at arbitrary phase to the scans.
+        time += pressed ? 100000 + rng() % 100000 : 50000 + rng() % 50000;
+        run_until(time);
+        if (pending_since != NOT_PENDING) {
+            results.missed++;
+        }
+        for (uint8_t k = 0; k < scenario->key_count; k++) {
+            devices[scenario->source].matrix_set(scenario->row, scenario->cols[k], pressed);
+        }
+        results.events++;
+        expected      = pressed ? scenario->key_count : 0;
+        pending_since = now;
+    }
+    run_until(time + 100000);
+    if (pending_since != NOT_PENDING) {
+        results.missed++;
+    }
+    devices_unload();
+
+    uint32_t *latency = results.latency_us;
+    uint32_t  count   = results.latency_count;
+    qsort(latency, count, sizeof(uint32_t), compare_u32);
+    printf("%-42s %7u %8u %8u %8u %8.2f %9.1f %9.1f %6u\n", scenario->name, results.events, count ? latency[count / 2] : 0, count ? latency[count * 99 / 100] : 0, count ? latency[count - 1] : 0, (double)results.packets / results.events, (double)results.packets * REPORT_SIZE / results.events, (double)results.payload_bytes / results.events, results.missed);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-n events] [-s seed] [-c cantor_scan_us] [-m madromys_scan_us] [-r relay_us] cantor.so madromys.so\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    uint32_t events = 1000;
+    int      opt;
+    while ((opt = getopt(argc, argv, "n:s:c:m:r:")) != -1) {
+        switch (opt) {
+            case 'n':
+                events = atoi(optarg);
+                break;
+            case 's':
+                rng_state = atoi(optarg);
+                break;
+            case 'c':
+                scan_us[CANTOR] = atoi(optarg);
+                break;
+            case 'm':
+                scan_us[MADROMYS] = atoi(optarg);
+                break;
+            case 'r':
+                relay_us = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2 || events == 0 || rng_state == 0 || scan_us[CANTOR] == 0 || scan_us[MADROMYS] == 0) {
+        usage(argv[0]);
+    }
+    paths[CANTOR]   = argv[optind];
+    paths[MADROMYS] = argv[optind + 1];
+
+    printf("scan %u/%u us, relay %u us, %u press/release pairs per scenario\n\n", scan_us[CANTOR], scan_us[MADROMYS], relay_us, events);
+    printf("%-42s %7s %8s %8s %8s %8s %9s %9s %6s\n", "scenario", "events", "p50 us", "p99 us", "max us", "pkts/ev", "bytes/ev", "payld/ev", "missed");
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        scenario_run(&scenarios[i], events);
+    }
+    free(results.latency_us);
+    return 0;
+}
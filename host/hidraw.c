@@ -0,0 +1,83 @@
+#include "hidraw.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/hidraw.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+// The QMK raw HID collection: usage page 0xFF60, usage 0x61.
+bool hidraw_is_raw_hid(int fd) {
+    int size = 0;
+    if (ioctl(fd, HIDIOCGRDESCSIZE, &size) < 0) {
+        return false;
+    }
+    struct hidraw_report_descriptor descriptor = {.size = size};
+    if (ioctl(fd, HIDIOCGRDESC, &descriptor) < 0) {
+        return false;
+    }
+    for (uint32_t i = 0; i + 4 < descriptor.size; i++) {
+        if (descriptor.value[i] == 0x06 && descriptor.value[i + 1] == 0x60 && descriptor.value[i + 2] == 0xFF && descriptor.value[i + 3] == 0x09 && descriptor.value[i + 4] == 0x61) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void hidraw_scan(void (*found)(const char *path)) {
+    char path[32];
+    for (int i = 0; i < MAX_HIDRAW; i++) {
+        snprintf(path, sizeof(path), "/dev/hidraw%d", i);
+        int fd = open(path, O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        bool raw_hid = hidraw_is_raw_hid(fd);
+        close(fd);
+        if (raw_hid) {
+            found(path);
+        }
+    }
+}
+
+bool hidraw_write(int fd, const uint8_t *report) {
+    uint8_t buffer[1 + REPORT_SIZE] = {0}; // no report ID
+    memcpy(&buffer[1], report, REPORT_SIZE);
+    return write(fd, buffer, sizeof(buffer)) == sizeof(buffer);
+}
+
+static int64_t now_ms(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (int64_t)time.tv_sec * 1000 + time.tv_nsec / 1000000;
+}
+
+// Other IN reports (shared keys, mirror, matrix stream) are skipped.
+bool hidraw_read_reply(int fd, uint8_t command, uint8_t *report, int timeout_ms) {
+    int64_t deadline = now_ms() + timeout_ms;
+    while (true) {
+        int64_t left = deadline - now_ms();
+        if (left <= 0) {
+            return false;
+        }
+        struct pollfd fds   = {.fd = fd, .events = POLLIN};
+        int           ready = poll(&fds, 1, left);
+        if (ready < 0 && errno != EINTR) {
+            return false;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+        ssize_t length = read(fd, report, REPORT_SIZE);
+        if (length <= 0) {
+            return false;
+        }
+        memset(&report[length], 0, REPORT_SIZE - length);
+        if (report[0] == command) {
+            return true;
+        }
+    }
+}
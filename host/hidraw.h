@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// hidraw helpers shared by the host tools.
+
+#define REPORT_SIZE 32
+#define MAX_HIDRAW 64
+
+// True if fd is a hidraw node of the QMK raw HID collection.
+bool hidraw_is_raw_hid(int fd);
+// Calls found with the path of every raw HID node, in /dev/hidrawN order.
+void hidraw_scan(void (*found)(const char *path));
+// Writes one OUT report, without report ID.
+bool hidraw_write(int fd, const uint8_t *report);
+// Reads IN reports until one starts with command. Returns false on error or
+// after timeout_ms without one.
+bool hidraw_read_reply(int fd, uint8_t command, uint8_t *report, int timeout_ms);
@@ -0,0 +1,160 @@
+// Key trace decoder: drains the key event ring of windexlight devices over raw
+// HID and prints it, oldest event first.
+//
+//     keytrace [-f] [-i interval_ms] [/dev/hidrawN ...]
+//
+// Without device paths every hidraw node exposing the QMK raw HID usage is
+// read. -f keeps polling every interval_ms (default 200) and prints events as
+// they come in, so it can run while reproducing a problem.
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hidraw.h"
+#include "key_trace.h"
+#include "raw_hid_commands.h"
+
+#define MAX_DEVICES 8
+#define REPLY_TIMEOUT_MS 500
+
+typedef struct {
+    int      fd;
+    char     path[32];
+    bool     seen; // last_time is valid
+    uint16_t last_time;
+} device_t;
+
+static device_t devices[MAX_DEVICES];
+static int      device_count = 0;
+
+static bool device_open(const char *path) {
+    if (device_count == MAX_DEVICES) {
+        return false;
+    }
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+    device_t *device = &devices[device_count++];
+    device->fd       = fd;
+    snprintf(device->path, sizeof(device->path), "%s", path);
+    return true;
+}
+
+static void device_found(const char *path) {
+    device_open(path);
+}
+
+static void entry_print(device_t *device, const key_trace_entry_t *entry) {
+    // Times are the device's 16-bit millisecond timer, shown with the gap to
+    // the previous event.
+    uint16_t delta = device->seen ? (uint16_t)(entry->time - device->last_time) : 0;
+    device->seen      = true;
+    device->last_time = entry->time;
+    printf("%s %5u +%-5u  %-4s row %2u col %2u  kc 0x%04X  layer %2u", device->path, entry->time, delta, entry->flags & KEY_TRACE_PRESSED ? "down" : "up", entry->row, entry->col, entry->keycode, entry->layer);
+    if (entry->flags >> KEY_TRACE_COUNT_SHIFT) {
+        printf("  tap %u", entry->flags >> KEY_TRACE_COUNT_SHIFT);
+    }
+    if (entry->flags & KEY_TRACE_INTERRUPTED) {
+        printf("  interrupted");
+    }
+    printf("\n");
+}
+
+// Reads replies until the ring is empty.
+static bool device_drain(device_t *device) {
+    uint8_t request[REPORT_SIZE] = {RAW_HID_CMD_KEY_TRACE, KEY_TRACE_DRAIN_FRAMES};
+    uint8_t frames               = 0;
+    if (!hidraw_write(device->fd, request)) {
+        perror(device->path);
+        return false;
+    }
+    while (true) {
+        uint8_t report[REPORT_SIZE];
+        if (!hidraw_read_reply(device->fd, RAW_HID_CMD_KEY_TRACE, report, REPLY_TIMEOUT_MS)) {
+            fprintf(stderr, "%s: no key trace reply\n", device->path);
+            return false;
+        }
+        uint16_t dropped = report[3] | report[4] << 8;
+        if (dropped) {
+            printf("%s ... %u events overwritten\n", device->path, dropped);
+            device->seen = false;
+        }
+        uint8_t count = report[1] < KEY_TRACE_FRAME_ENTRIES ? report[1] : KEY_TRACE_FRAME_ENTRIES;
+        for (uint8_t i = 0; i < count; i++) {
+            key_trace_entry_t entry;
+            memcpy(&entry, &report[KEY_TRACE_FRAME_HEADER + i * sizeof(entry)], sizeof(entry));
+            entry_print(device, &entry);
+        }
+        if (report[2] == 0) {
+            return true;
+        }
+        // A full batch with more left, ask for the next one.
+        if (++frames == KEY_TRACE_DRAIN_FRAMES) {
+            frames = 0;
+            if (!hidraw_write(device->fd, request)) {
+                perror(device->path);
+                return false;
+            }
+        }
+    }
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-f] [-i interval_ms] [/dev/hidrawN ...]\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    bool     follow      = false;
+    uint32_t interval_ms = 200;
+    int      opt;
+    while ((opt = getopt(argc, argv, "fi:")) != -1) {
+        switch (opt) {
+            case 'f':
+                follow = true;
+                break;
+            case 'i':
+                interval_ms = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (interval_ms == 0) {
+        usage(argv[0]);
+    }
+    if (optind < argc) {
+        for (int i = optind; i < argc; i++) {
+            if (!device_open(argv[i])) {
+                return 1;
+            }
+        }
+    } else {
+        hidraw_scan(device_found);
+        if (device_count == 0) {
+            fprintf(stderr, "no raw HID devices found\n");
+            return 1;
+        }
+    }
+
+    do {
+        for (int i = 0; i < device_count; i++) {
+            if (devices[i].fd >= 0 && !device_drain(&devices[i])) {
+                close(devices[i].fd);
+                devices[i].fd = -1;
+            }
+        }
+        fflush(stdout);
+        if (follow) {
+            usleep(interval_ms * 1000);
+        }
+    } while (follow);
+    return 0;
+}
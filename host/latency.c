@@ -0,0 +1,130 @@
+// Reads the hot-path latency counters of windexlight devices over raw HID.
+//
+//     latency [-r] [-w seconds] [/dev/hidrawN ...]
+//
+// Prints the counters collected since the last reset; -r resets them after
+// reading. -w resets, waits the given time and then reads, to measure a window
+// of typing. Without device paths every raw HID device is read.
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hidraw.h"
+#include "latency_stats.h"
+#include "raw_hid_commands.h"
+
+#define MAX_DEVICES 8
+#define REPLY_TIMEOUT_MS 500
+
+static const char *stat_names[LATENCY_STAT_COUNT] = {
+    [LATENCY_SCAN]           = "scan period",
+    [LATENCY_PROCESS_RECORD] = "process_record_user",
+    [LATENCY_KEY_TO_REPORT]  = "key event to report",
+    [LATENCY_RAW_HID_SEND]   = "raw_hid_send",
+};
+
+static const char *paths[MAX_DEVICES];
+static int         path_count = 0;
+
+static void device_found(const char *path) {
+    if (path_count < MAX_DEVICES) {
+        paths[path_count++] = strdup(path);
+    }
+}
+
+static bool stats_read(int fd, bool reset, latency_stats_t *stats) {
+    uint8_t request[REPORT_SIZE] = {RAW_HID_CMD_LATENCY_STATS, reset};
+    if (!hidraw_write(fd, request)) {
+        return false;
+    }
+    uint8_t *block = (uint8_t *)stats;
+    size_t   got   = 0;
+    while (got < sizeof(*stats)) {
+        uint8_t report[REPORT_SIZE];
+        if (!hidraw_read_reply(fd, RAW_HID_CMD_LATENCY_STATS, report, REPLY_TIMEOUT_MS) || report[1] != got) {
+            return false;
+        }
+        size_t size = sizeof(*stats) - got < REPORT_SIZE - LATENCY_STATS_FRAME_HEADER ? sizeof(*stats) - got : REPORT_SIZE - LATENCY_STATS_FRAME_HEADER;
+        memcpy(&block[got], &report[LATENCY_STATS_FRAME_HEADER], size);
+        got += size;
+    }
+    return true;
+}
+
+static double ticks_us(const latency_stats_t *stats, double ticks) {
+    return ticks * 1000.0 / stats->clock_khz;
+}
+
+static void stats_print(const char *path, const latency_stats_t *stats) {
+    const latency_stat_t *scan = &stats->stats[LATENCY_SCAN];
+    printf("%s: %u.%03u s, clock %u kHz, %.0f scans/s\n", path, stats->elapsed_ms / 1000, stats->elapsed_ms % 1000, stats->clock_khz, stats->elapsed_ms ? scan->count * 1000.0 / stats->elapsed_ms : 0.0);
+    printf("  %-22s %10s %12s %12s\n", "", "count", "avg us", "max us");
+    for (int i = 0; i < LATENCY_STAT_COUNT; i++) {
+        const latency_stat_t *stat = &stats->stats[i];
+        printf("  %-22s %10u %12.2f %12.2f\n", stat_names[i], stat->count, stat->count ? ticks_us(stats, (double)stat->total / stat->count) : 0.0, ticks_us(stats, stat->max));
+    }
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-r] [-w seconds] [/dev/hidrawN ...]\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    bool     reset   = false;
+    uint32_t wait_s  = 0;
+    int      opt;
+    while ((opt = getopt(argc, argv, "rw:")) != -1) {
+        switch (opt) {
+            case 'r':
+                reset = true;
+                break;
+            case 'w':
+                wait_s = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    for (int i = optind; i < argc && path_count < MAX_DEVICES; i++) {
+        paths[path_count++] = argv[i];
+    }
+    if (path_count == 0) {
+        hidraw_scan(device_found);
+        if (path_count == 0) {
+            fprintf(stderr, "no raw HID devices found\n");
+            return 1;
+        }
+    }
+
+    int fds[MAX_DEVICES];
+    for (int i = 0; i < path_count; i++) {
+        fds[i] = open(paths[i], O_RDWR | O_CLOEXEC);
+        if (fds[i] < 0) {
+            perror(paths[i]);
+            return 1;
+        }
+    }
+    latency_stats_t stats;
+    if (wait_s) {
+        for (int i = 0; i < path_count; i++) {
+            stats_read(fds[i], true, &stats);
+        }
+        sleep(wait_s);
+    }
+    int status = 0;
+    for (int i = 0; i < path_count; i++) {
+        if (!stats_read(fds[i], reset, &stats)) {
+            fprintf(stderr, "%s: no latency stats reply\n", paths[i]);
+            status = 1;
+            continue;
+        }
+        stats_print(paths[i], &stats);
+    }
+    return status;
+}
@@ -0,0 +1,496 @@
+// Shared-key relay: forwards shared-key state between the raw HID interfaces
+// of all connected windexlight devices and keeps them alive with heartbeats.
+//
+//     relay [-i heartbeat_ms] [/dev/hidrawN ...]
+//     relay -f [-n samples] [-p period_ms]
+//
+// Without device paths every hidraw node exposing the QMK raw HID usage is
+// picked up, including devices plugged in later. -f creates two fake devices
+// through uhid instead and measures the latency of shared-key frames from one
+// fake, through the kernel and the relay, to the other.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/hidraw.h>
+#include <linux/uhid.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hidraw.h"
+#include "raw_hid_commands.h"
+#include "shared_keys.h"
+
+#define MAX_DEVICES 8
+#define RELAY_PROTOCOL_VERSION SHARED_KEYS_PROTOCOL_VERSION
+#define FAKE_NAME "windexlight fake"
+#define FAKE_KEY _SK_NAV
+
+// epoll tags.
+enum {
+    TAG_HEARTBEAT,
+    TAG_RESCAN,
+    TAG_BENCH,
+    TAG_DEVICE = 0x100,
+    TAG_FAKE   = 0x200,
+};
+
+typedef struct {
+    int  fd;
+    char path[32];
+    // Reports are read in after the report ID slot, so a frame is forwarded
+    // from the buffer it arrived in.
+    uint8_t buffer[1 + REPORT_SIZE];
+} device_t;
+
+typedef struct {
+    int      fd;
+    uint8_t  id;
+    uint8_t  host_version;
+    bool     synced;
+    uint16_t seq;
+    uint32_t keys;
+    uint64_t sent_ns[256]; // send time by low byte of seq
+} fake_t;
+
+static int      epoll_fd;
+static device_t devices[MAX_DEVICES];
+static fake_t   fakes[2];
+static bool     fake_mode    = false;
+static bool     scan_mode    = true;
+static uint16_t heartbeat_ms = 500;
+
+static uint32_t  bench_samples = 1000;
+static uint32_t  bench_count   = 0;
+static uint64_t *bench_ns;
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int sig) {
+    running = 0;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void watch(int fd, uint32_t tag) {
+    struct epoll_event event = {.events = EPOLLIN, .data.u32 = tag};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        perror("epoll_ctl");
+        exit(1);
+    }
+}
+
+static int timer_open(uint32_t period_ms, uint32_t tag) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        perror("timerfd_create");
+        exit(1);
+    }
+    struct itimerspec spec = {
+        .it_interval = {period_ms / 1000, (period_ms % 1000) * 1000000},
+        .it_value    = {period_ms / 1000, (period_ms % 1000) * 1000000},
+    };
+    timerfd_settime(fd, 0, &spec, NULL);
+    watch(fd, tag);
+    return fd;
+}
+
+static void timer_drain(int fd) {
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+        perror("timerfd");
+    }
+}
+
+// Devices
+
+static void device_close(device_t *device) {
+    fprintf(stderr, "%s: disconnected\n", device->path);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, device->fd, NULL);
+    close(device->fd);
+    device->fd = -1;
+}
+
+static void device_write(device_t *device, const uint8_t *report) {
+    if (device->fd >= 0 && write(device->fd, report, 1 + REPORT_SIZE) < 0) {
+        device_close(device);
+    }
+}
+
+static bool is_fake(int fd) {
+    char name[256] = {0};
+    return ioctl(fd, HIDIOCGRAWNAME(sizeof(name) - 1), name) >= 0 && strncmp(name, FAKE_NAME, strlen(FAKE_NAME)) == 0;
+}
+
+static bool device_open(const char *path, bool probe) {
+    device_t *free_slot = NULL;
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        if (devices[i].fd >= 0 && strcmp(devices[i].path, path) == 0) {
+            return true;
+        }
+        if (devices[i].fd < 0 && !free_slot) {
+            free_slot = &devices[i];
+        }
+    }
+    if (!free_slot) {
+        return false;
+    }
+    int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        if (!probe) {
+            perror(path);
+        }
+        return false;
+    }
+    // Fakes are matched by name so that -f never talks to real keyboards.
+    if (probe && !(fake_mode ? is_fake(fd) : hidraw_is_raw_hid(fd))) {
+        close(fd);
+        return false;
+    }
+    free_slot->fd = fd;
+    snprintf(free_slot->path, sizeof(free_slot->path), "%s", path);
+    watch(fd, TAG_DEVICE + (free_slot - devices));
+    fprintf(stderr, "%s: connected\n", path);
+    return true;
+}
+
+static void devices_scan(void) {
+    char path[32];
+    for (int i = 0; i < MAX_HIDRAW; i++) {
+        snprintf(path, sizeof(path), "/dev/hidraw%d", i);
+        if (access(path, F_OK) == 0) {
+            device_open(path, true);
+        }
+    }
+}
+
+static void heartbeat_send(void) {
+    uint8_t report[1 + REPORT_SIZE] = {0, RAW_HID_CMD_HEARTBEAT, RELAY_PROTOCOL_VERSION};
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        device_write(&devices[i], report);
+    }
+}
+
+// Legacy 0xC0 snapshots go out as 0xC1, frames as they are. Everything else a
+// device sends (mirror, matrix stream, query replies) is for other tools.
+static void device_read(device_t *source) {
+    uint8_t *report = &source->buffer[1];
+    ssize_t  length = read(source->fd, report, REPORT_SIZE);
+    if (length < 0) {
+        if (errno != EAGAIN) {
+            device_close(source);
+        }
+        return;
+    }
+    if (length == 0) {
+        return;
+    }
+    if (length < REPORT_SIZE) {
+        memset(&report[length], 0, REPORT_SIZE - length);
+    }
+    switch (report[0]) {
+        case RAW_HID_CMD_HEARTBEAT:
+            report[0] = RAW_HID_CMD_SHARED_KEYS;
+            break;
+        case RAW_HID_CMD_SHARED_KEYS_FRAME:
+            break;
+        default:
+            return;
+    }
+    source->buffer[0] = 0; // no report ID
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        if (&devices[i] != source) {
+            device_write(&devices[i], source->buffer);
+        }
+    }
+}
+
+// Fake devices
+
+static const uint8_t raw_hid_descriptor[] = {
+    0x06, 0x60, 0xFF,       // Usage Page (Vendor Defined)
+    0x09, 0x61,             // Usage (Vendor Defined)
+    0xA1, 0x01,             // Collection (Application)
+    0x09, 0x62,             //   Usage (Vendor Defined)
+    0x15, 0x00,             //   Logical Minimum (0)
+    0x26, 0xFF, 0x00,       //   Logical Maximum (255)
+    0x95, REPORT_SIZE,      //   Report Count
+    0x75, 0x08,             //   Report Size (8)
+    0x81, 0x02,             //   Input (Data, Variable, Absolute)
+    0x09, 0x63,             //   Usage (Vendor Defined)
+    0x15, 0x00,             //   Logical Minimum (0)
+    0x26, 0xFF, 0x00,       //   Logical Maximum (255)
+    0x95, REPORT_SIZE,      //   Report Count
+    0x75, 0x08,             //   Report Size (8)
+    0x91, 0x02,             //   Output (Data, Variable, Absolute)
+    0xC0,                   // End Collection
+};
+
+static void fake_create(fake_t *fake, uint8_t id) {
+    fake->fd = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+    if (fake->fd < 0) {
+        perror("/dev/uhid");
+        exit(1);
+    }
+    fake->id = id;
+    struct uhid_event event = {.type = UHID_CREATE2};
+    snprintf((char *)event.u.create2.name, sizeof(event.u.create2.name), FAKE_NAME " %u", id);
+    memcpy(event.u.create2.rd_data, raw_hid_descriptor, sizeof(raw_hid_descriptor));
+    event.u.create2.rd_size = sizeof(raw_hid_descriptor);
+    event.u.create2.bus     = BUS_VIRTUAL;
+    event.u.create2.vendor  = 0xFEED;
+    event.u.create2.product = id;
+    if (write(fake->fd, &event, sizeof(event)) < 0) {
+        perror("UHID_CREATE2");
+        exit(1);
+    }
+    watch(fake->fd, TAG_FAKE + (fake - fakes));
+}
+
+static void fake_destroy(fake_t *fake) {
+    struct uhid_event event = {.type = UHID_DESTROY};
+    if (write(fake->fd, &event, sizeof(event)) < 0) {
+        perror("UHID_DESTROY");
+    }
+    close(fake->fd);
+}
+
+static void fake_send_frame(fake_t *fake, uint8_t flags, uint8_t count, const uint8_t *data) {
+    struct uhid_event    event = {.type = UHID_INPUT2};
+    shared_keys_frame_t *frame = (shared_keys_frame_t *)event.u.input2.data;
+    frame->command   = RAW_HID_CMD_SHARED_KEYS_FRAME;
+    frame->version   = SHARED_KEYS_PROTOCOL_VERSION;
+    frame->sender    = fake->id;
+    frame->flags     = flags;
+    frame->seq       = fake->seq++;
+    frame->timestamp = now_ns() / 1000000;
+    frame->count     = count;
+    memcpy(frame->data, data, count);
+    event.u.input2.size = REPORT_SIZE;
+    fake->sent_ns[frame->seq & 0xFF] = now_ns();
+    if (write(fake->fd, &event, sizeof(event)) < 0) {
+        perror("UHID_INPUT2");
+    }
+}
+
+static void fake_sync(fake_t *fake) {
+    uint8_t data[4] = {fake->keys, fake->keys >> 8, fake->keys >> 16, fake->keys >> 24};
+    fake_send_frame(fake, SHARED_KEYS_FRAME_SYNC, sizeof(data), data);
+    fake->synced = true;
+}
+
+static void fake_toggle(fake_t *fake, uint8_t key) {
+    fake->keys ^= (uint32_t)1 << key;
+    fake_send_frame(fake, SHARED_KEYS_FRAME_DELTA, 1, &key);
+}
+
+static void fake_receive(fake_t *fake, const uint8_t *data, uint16_t size) {
+    // hidraw writes keep the report ID byte, zero without report IDs.
+    if (size == 1 + REPORT_SIZE) {
+        data++;
+        size--;
+    }
+    if (size < REPORT_SIZE) {
+        return;
+    }
+    switch (data[0]) {
+        case RAW_HID_CMD_HEARTBEAT:
+            fake->host_version = data[1];
+            if (fake->host_version >= SHARED_KEYS_PROTOCOL_VERSION && !fake->synced) {
+                fake_sync(fake);
+            }
+            break;
+        case RAW_HID_CMD_SHARED_KEYS_FRAME: {
+            const shared_keys_frame_t *frame = (const shared_keys_frame_t *)data;
+            if (!(frame->flags & SHARED_KEYS_FRAME_DELTA) || frame->sender < 1 || frame->sender > 2 || frame->sender == fake->id) {
+                break;
+            }
+            uint64_t sent = fakes[frame->sender - 1].sent_ns[frame->seq & 0xFF];
+            if (bench_count < bench_samples) {
+                bench_ns[bench_count++] = now_ns() - sent;
+            }
+            if (bench_count == bench_samples) {
+                running = 0;
+            }
+            break;
+        }
+    }
+}
+
+static void fake_read(fake_t *fake) {
+    struct uhid_event event;
+    if (read(fake->fd, &event, sizeof(event)) < 0) {
+        perror("uhid");
+        running = 0;
+        return;
+    }
+    switch (event.type) {
+        case UHID_OUTPUT:
+            fake_receive(fake, event.u.output.data, event.u.output.size);
+            break;
+        default:
+            break;
+    }
+}
+
+// Alternates between the fakes, toggling one shared key per tick.
+static void bench_tick(void) {
+    static uint32_t tick = 0;
+    if (fakes[0].synced && fakes[1].synced) {
+        fake_toggle(&fakes[tick++ & 1], FAKE_KEY);
+    }
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_report(void) {
+    if (bench_count == 0) {
+        printf("no samples\n");
+        return;
+    }
+    qsort(bench_ns, bench_count, sizeof(bench_ns[0]), compare_u64);
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < bench_count; i++) {
+        total += bench_ns[i];
+    }
+    printf("samples %u\n", bench_count);
+    printf("min     %8.1f us\n", bench_ns[0] / 1000.0);
+    printf("median  %8.1f us\n", bench_ns[bench_count / 2] / 1000.0);
+    printf("p99     %8.1f us\n", bench_ns[(bench_count * 99) / 100] / 1000.0);
+    printf("max     %8.1f us\n", bench_ns[bench_count - 1] / 1000.0);
+    printf("mean    %8.1f us\n", total / 1000.0 / bench_count);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-i heartbeat_ms] [/dev/hidrawN ...]\n"
+            "       %s -f [-i heartbeat_ms] [-n samples] [-p period_ms]\n",
+            name, name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    uint32_t bench_period_ms = 10;
+    int      opt;
+    while ((opt = getopt(argc, argv, "fi:n:p:")) != -1) {
+        switch (opt) {
+            case 'f':
+                fake_mode = true;
+                break;
+            case 'i':
+                heartbeat_ms = atoi(optarg);
+                break;
+            case 'n':
+                bench_samples = atoi(optarg);
+                break;
+            case 'p':
+                bench_period_ms = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (heartbeat_ms == 0 || bench_samples == 0 || bench_period_ms == 0 || (fake_mode && optind < argc)) {
+        usage(argv[0]);
+    }
+
+    struct sigaction action = {.sa_handler = on_signal};
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        return 1;
+    }
+    for (int i = 0; i < MAX_DEVICES; i++) {
+        devices[i].fd = -1;
+    }
+
+    int heartbeat_fd = timer_open(heartbeat_ms, TAG_HEARTBEAT);
+    int rescan_fd    = -1;
+    int bench_fd     = -1;
+    if (fake_mode) {
+        bench_ns = calloc(bench_samples, sizeof(bench_ns[0]));
+        fake_create(&fakes[0], 1);
+        fake_create(&fakes[1], 2);
+        bench_fd  = timer_open(bench_period_ms, TAG_BENCH);
+        rescan_fd = timer_open(50, TAG_RESCAN); // until the hidraw nodes show up
+    } else if (optind < argc) {
+        scan_mode = false;
+        for (int i = optind; i < argc; i++) {
+            if (!device_open(argv[i], false)) {
+                return 1;
+            }
+        }
+    } else {
+        devices_scan();
+        rescan_fd = timer_open(1000, TAG_RESCAN);
+    }
+    heartbeat_send();
+
+    while (running) {
+        struct epoll_event events[16];
+        int                count = epoll_wait(epoll_fd, events, 16, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < count && running; i++) {
+            uint32_t tag = events[i].data.u32;
+            if (tag >= TAG_FAKE) {
+                fake_read(&fakes[tag - TAG_FAKE]);
+            } else if (tag >= TAG_DEVICE) {
+                device_t *device = &devices[tag - TAG_DEVICE];
+                if (device->fd >= 0) {
+                    device_read(device);
+                }
+            } else if (tag == TAG_HEARTBEAT) {
+                timer_drain(heartbeat_fd);
+                heartbeat_send();
+            } else if (tag == TAG_RESCAN) {
+                timer_drain(rescan_fd);
+                devices_scan();
+            } else if (tag == TAG_BENCH) {
+                timer_drain(bench_fd);
+                bench_tick();
+            }
+        }
+        if (!scan_mode) {
+            bool any = false;
+            for (int d = 0; d < MAX_DEVICES; d++) {
+                any |= devices[d].fd >= 0;
+            }
+            if (!any) {
+                fprintf(stderr, "no devices left\n");
+                break;
+            }
+        }
+    }
+
+    if (fake_mode) {
+        fake_destroy(&fakes[0]);
+        fake_destroy(&fakes[1]);
+        bench_report();
+        free(bench_ns);
+    }
+    return 0;
+}
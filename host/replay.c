@@ -0,0 +1,598 @@
+// Trace replay: drives a keymap built against host/sim with a recorded or
+// hand-written key-event trace, checks the HID reports it sends and reports the
+// time spent per key event.
+//
+//     replay [-v] [-c scan_us] [-r repeat] keymap.so trace...
+//
+// A trace is one command per line, '#' starts a comment. Each line may start
+// with a time in ms, absolute or +relative to the previous line; without one
+// it runs at the same time as the previous line. The main loop runs every
+// scan_us (default 250) up to that time, then the command runs:
+//
+//     down ROW COL        switch pressed, seen by the next scan
+//     up ROW COL          switch released
+//     raw XX XX ...       raw HID OUT report, hex bytes
+//     expect [MODS] [KEYS] next keyboard report, e.g. "expect LSFT T"; an
+//                         empty one is just "expect"
+//     expect system|consumer USAGE
+//                         next extra report, usage in hex
+//     typed "TEXT"        text typed since the previous typed line
+//     layers [N ...]      layers on, besides the default layer
+//
+// Mod and key names are QMK's without the KC_ prefix, hex usages are taken as
+// well. Typed text is what the key-down transitions of the keyboard reports
+// type on a US layout, other keys in vim notation: <CR>, <Esc>, <BS>, <Tab>,
+// <Del>, <Left>, <C-z>, <S-Tab>, <lt> for '<'. Reports or text nobody asked
+// for are an error at the end of a trace once it uses expect or typed.
+//
+// -v prints every report as it is sent, as a trace line, which is a quick way
+// to write the assertions for a new trace. -r replays each trace several times,
+// on a freshly loaded keymap each time, for steadier timings.
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sim/sim.h"
+
+#define REPORT_SIZE 32
+#define KEYBOARD_KEYS 6
+#define MAX_REPORTS 256
+#define MAX_TEXT 1024
+#define MAX_LINE 512
+#define MAX_TOKENS 40
+#define SETTLE_MS 1000 // run after the last line, for timeouts to play out
+
+enum { REPORT_KEYBOARD, REPORT_SYSTEM, REPORT_CONSUMER };
+
+typedef struct {
+    uint8_t  type;
+    uint8_t  mods;
+    uint8_t  keys[KEYBOARD_KEYS];
+    uint16_t usage;
+} report_t;
+
+// Report IDs from QMK's report.h.
+#define REPORT_ID_SYSTEM 3
+#define REPORT_ID_CONSUMER 4
+
+static const char *const mod_names[8] = {"LCTL", "LSFT", "LALT", "LGUI", "RCTL", "RSFT", "RALT", "RGUI"};
+
+// Keyboard usages 0x04..0x53 by QMK name, and what they type on a US layout:
+// unshifted and shifted character, or a vim key name.
+typedef struct {
+    const char *name;
+    char        plain;
+    char        shifted;
+    const char *vim;
+} usage_t;
+
+#define USAGE_FIRST 0x04
+// clang-format off
+static const usage_t usages[] = {
+    {"A", 'a', 'A', NULL}, {"B", 'b', 'B', NULL}, {"C", 'c', 'C', NULL}, {"D", 'd', 'D', NULL}, {"E", 'e', 'E', NULL}, {"F", 'f', 'F', NULL},
+    {"G", 'g', 'G', NULL}, {"H", 'h', 'H', NULL}, {"I", 'i', 'I', NULL}, {"J", 'j', 'J', NULL}, {"K", 'k', 'K', NULL}, {"L", 'l', 'L', NULL},
+    {"M", 'm', 'M', NULL}, {"N", 'n', 'N', NULL}, {"O", 'o', 'O', NULL}, {"P", 'p', 'P', NULL}, {"Q", 'q', 'Q', NULL}, {"R", 'r', 'R', NULL},
+    {"S", 's', 'S', NULL}, {"T", 't', 'T', NULL}, {"U", 'u', 'U', NULL}, {"V", 'v', 'V', NULL}, {"W", 'w', 'W', NULL}, {"X", 'x', 'X', NULL},
+    {"Y", 'y', 'Y', NULL}, {"Z", 'z', 'Z', NULL},
+    {"1", '1', '!', NULL}, {"2", '2', '@', NULL}, {"3", '3', '#', NULL}, {"4", '4', '$', NULL}, {"5", '5', '%', NULL},
+    {"6", '6', '^', NULL}, {"7", '7', '&', NULL}, {"8", '8', '*', NULL}, {"9", '9', '(', NULL}, {"0", '0', ')', NULL},
+    {"ENT", 0, 0, "CR"}, {"ESC", 0, 0, "Esc"}, {"BSPC", 0, 0, "BS"}, {"TAB", 0, 0, "Tab"}, {"SPC", ' ', ' ', "Space"},
+    {"MINS", '-', '_', NULL}, {"EQL", '=', '+', NULL}, {"LBRC", '[', '{', NULL}, {"RBRC", ']', '}', NULL}, {"BSLS", '\\', '|', NULL},
+    {"NUHS", '#', '~', NULL}, {"SCLN", ';', ':', NULL}, {"QUOT", '\'', '"', NULL}, {"GRV", '`', '~', NULL}, {"COMM", ',', '<', NULL},
+    {"DOT", '.', '>', NULL}, {"SLSH", '/', '?', NULL}, {"CAPS", 0, 0, "CapsLock"},
+    {"F1", 0, 0, "F1"}, {"F2", 0, 0, "F2"}, {"F3", 0, 0, "F3"}, {"F4", 0, 0, "F4"}, {"F5", 0, 0, "F5"}, {"F6", 0, 0, "F6"},
+    {"F7", 0, 0, "F7"}, {"F8", 0, 0, "F8"}, {"F9", 0, 0, "F9"}, {"F10", 0, 0, "F10"}, {"F11", 0, 0, "F11"}, {"F12", 0, 0, "F12"},
+    {"PSCR", 0, 0, "PrintScreen"}, {"SCRL", 0, 0, "ScrollLock"}, {"PAUS", 0, 0, "Pause"}, {"INS", 0, 0, "Insert"},
+    {"HOME", 0, 0, "Home"}, {"PGUP", 0, 0, "PageUp"}, {"DEL", 0, 0, "Del"}, {"END", 0, 0, "End"}, {"PGDN", 0, 0, "PageDown"},
+    {"RGHT", 0, 0, "Right"}, {"LEFT", 0, 0, "Left"}, {"DOWN", 0, 0, "Down"}, {"UP", 0, 0, "Up"}, {"NUM", 0, 0, "NumLock"},
+};
+// clang-format on
+
+#define USAGE_COUNT (sizeof(usages) / sizeof(usages[0]))
+
+static sim_device_t device;
+static uint32_t     scan_us = 250;
+static bool         verbose;
+
+// Per trace run.
+static const char *trace_name;
+static uint32_t    trace_line;
+static uint32_t    now_us;
+static uint32_t    next_scan_us;
+static bool        failed;
+static report_t    reports[MAX_REPORTS];
+static uint32_t    report_head, report_count;
+static bool        reports_checked;
+static bool        reports_dropped;
+static char        text[MAX_TEXT];
+static uint32_t    text_length;
+static bool        text_checked;
+static uint8_t     last_keys[KEYBOARD_KEYS];
+
+// Timing, across runs.
+static uint64_t event_ns, idle_ns;
+static uint32_t events, idle_scans, pending_events;
+
+static void fail(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+static void fail(const char *format, ...) {
+    if (failed) {
+        return;
+    }
+    failed = true;
+    fprintf(stderr, "%s:%u: ", trace_name, trace_line);
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+static uint64_t clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Formatting
+
+static const char *usage_name(uint8_t usage, char *buffer) {
+    if (usage >= USAGE_FIRST && usage < USAGE_FIRST + USAGE_COUNT) {
+        return usages[usage - USAGE_FIRST].name;
+    }
+    sprintf(buffer, "0x%02X", usage);
+    return buffer;
+}
+
+static void report_format(const report_t *report, char *out) {
+    char buffer[8];
+    if (report->type != REPORT_KEYBOARD) {
+        sprintf(out, "%s 0x%04X", report->type == REPORT_SYSTEM ? "system" : "consumer", report->usage);
+        return;
+    }
+    *out                  = 0;
+    const char *separator = "";
+    for (uint8_t i = 0; i < 8; i++) {
+        if (report->mods & (1 << i)) {
+            out += sprintf(out, "%s%s", separator, mod_names[i]);
+            separator = " ";
+        }
+    }
+    for (uint8_t i = 0; i < KEYBOARD_KEYS; i++) {
+        if (report->keys[i]) {
+            out += sprintf(out, "%s%s", separator, usage_name(report->keys[i], buffer));
+            separator = " ";
+        }
+    }
+}
+
+static void text_append(const char *string) {
+    size_t length = strlen(string);
+    if (text_length + length >= MAX_TEXT) {
+        fail("typed text overflow");
+        return;
+    }
+    memcpy(text + text_length, string, length + 1);
+    text_length += length;
+}
+
+// What a key going down types with the report's mods.
+static void text_key(uint8_t usage, uint8_t mods) {
+    bool shift = mods & 0x22;
+    bool chord = mods & 0xDD;
+    char buffer[32];
+    if (usage < USAGE_FIRST || usage >= USAGE_FIRST + USAGE_COUNT) {
+        sprintf(buffer, "<0x%02X>", usage);
+        text_append(buffer);
+        return;
+    }
+    const usage_t *key = &usages[usage - USAGE_FIRST];
+    if (!chord && key->plain && (key->plain != ' ' || !shift)) {
+        char character = shift ? key->shifted : key->plain;
+        text_append(character == '<' ? "<lt>" : (char[]){character, 0});
+        return;
+    }
+    char *out = buffer + sprintf(buffer, "<");
+    if (mods & 0x11) {
+        out += sprintf(out, "C-");
+    }
+    if (mods & 0x44) {
+        out += sprintf(out, "A-");
+    }
+    if (mods & 0x88) {
+        out += sprintf(out, "D-");
+    }
+    if (shift && (!key->plain || key->plain == ' ')) {
+        out += sprintf(out, "S-");
+    }
+    if (key->vim) {
+        sprintf(out, "%s>", key->vim);
+    } else {
+        sprintf(out, "%s>", key->plain == '<' ? "lt" : (char[]){shift ? key->shifted : key->plain, 0});
+    }
+    text_append(buffer);
+}
+
+// Host callbacks
+
+static void report_push(const report_t *report) {
+    if (verbose) {
+        char formatted[64];
+        report_format(report, formatted);
+        printf("%-6u expect %s\n", now_us / 1000, formatted);
+    }
+    if (report_count == MAX_REPORTS) {
+        // Only an error if an expect comes after this.
+        reports_dropped = true;
+        report_head     = (report_head + 1) % MAX_REPORTS;
+        report_count--;
+    }
+    reports[(report_head + report_count++) % MAX_REPORTS] = *report;
+}
+
+static void host_keyboard_report(void *context, uint8_t mods, const uint8_t *keys) {
+    report_t report = {.type = REPORT_KEYBOARD, .mods = mods};
+    memcpy(report.keys, keys, KEYBOARD_KEYS);
+    for (uint8_t i = 0; i < KEYBOARD_KEYS; i++) {
+        if (keys[i] && !memchr(last_keys, keys[i], KEYBOARD_KEYS)) {
+            text_key(keys[i], mods);
+        }
+    }
+    memcpy(last_keys, keys, KEYBOARD_KEYS);
+    report_push(&report);
+}
+
+static void host_extra_report(void *context, uint8_t report_id, uint16_t usage) {
+    report_t report = {.type = report_id == REPORT_ID_SYSTEM ? REPORT_SYSTEM : REPORT_CONSUMER, .usage = usage};
+    report_push(&report);
+}
+
+// Main loop
+
+// Runs every scan due up to and including time, timing the ones that pick up
+// switch changes separately from idle ones.
+static void run_until(uint32_t time) {
+    while (next_scan_us <= time) {
+        now_us = next_scan_us;
+        device.set_time(now_us);
+        uint64_t start = clock_ns();
+        device.scan();
+        uint64_t elapsed = clock_ns() - start;
+        if (pending_events) {
+            event_ns += elapsed;
+            events += pending_events;
+            pending_events = 0;
+        } else {
+            idle_ns += elapsed;
+            idle_scans++;
+        }
+        next_scan_us += scan_us;
+    }
+    now_us = time;
+    device.set_time(now_us);
+}
+
+// Commands
+
+static bool parse_number(const char *token, int base, uint32_t max, uint32_t *value) {
+    char *end;
+    if (!token) {
+        return false;
+    }
+    unsigned long parsed = strtoul(token, &end, base);
+    if (*end || end == token || parsed > max) {
+        return false;
+    }
+    *value = parsed;
+    return true;
+}
+
+static bool parse_usage(const char *token, uint8_t *usage) {
+    uint32_t value;
+    if (strncmp(token, "0x", 2) == 0 && parse_number(token, 16, 0xFF, &value)) {
+        *usage = value;
+        return true;
+    }
+    const char *name = strncmp(token, "KC_", 3) == 0 ? token + 3 : token;
+    for (uint8_t i = 0; i < USAGE_COUNT; i++) {
+        if (strcmp(name, usages[i].name) == 0) {
+            *usage = USAGE_FIRST + i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void command_switch(char **args, bool pressed) {
+    uint32_t row, col;
+    if (!parse_number(args[0], 10, 255, &row) || !parse_number(args[1], 10, 255, &col) || args[2]) {
+        fail("expected ROW COL");
+        return;
+    }
+    device.matrix_set(row, col, pressed);
+    pending_events++;
+}
+
+static void command_raw(char **args) {
+    uint8_t  data[REPORT_SIZE] = {0};
+    uint32_t length            = 0;
+    for (; args[length]; length++) {
+        uint32_t value;
+        if (length == REPORT_SIZE || !parse_number(args[length], 16, 0xFF, &value)) {
+            fail("bad raw report");
+            return;
+        }
+        data[length] = value;
+    }
+    device.raw_hid_receive(data, REPORT_SIZE);
+}
+
+static void command_expect(char **args) {
+    report_t expected = {.type = REPORT_KEYBOARD};
+    uint8_t  key      = 0;
+    reports_checked   = true;
+    if (args[0] && (strcmp(args[0], "system") == 0 || strcmp(args[0], "consumer") == 0)) {
+        uint32_t usage;
+        if (!parse_number(args[1], 16, 0xFFFF, &usage) || args[2]) {
+            fail("expected %s USAGE", args[0]);
+            return;
+        }
+        expected.type  = args[0][0] == 's' ? REPORT_SYSTEM : REPORT_CONSUMER;
+        expected.usage = usage;
+    } else {
+        for (; *args; args++) {
+            uint8_t mod;
+            for (mod = 0; mod < 8 && strcmp(*args, mod_names[mod]) != 0; mod++) {
+            }
+            if (mod < 8) {
+                expected.mods |= 1 << mod;
+            } else if (key == KEYBOARD_KEYS || !parse_usage(*args, &expected.keys[key++])) {
+                fail("bad key %s", *args);
+                return;
+            }
+        }
+    }
+
+    char want[64], got[64];
+    report_format(&expected, want);
+    if (reports_dropped) {
+        fail("more than %d reports before this expect", MAX_REPORTS);
+        return;
+    }
+    if (report_count == 0) {
+        fail("expected [%s], no report", want);
+        return;
+    }
+    report_t *report = &reports[report_head];
+    report_head      = (report_head + 1) % MAX_REPORTS;
+    report_count--;
+    // Keys in any slot.
+    bool match = report->type == expected.type && report->mods == expected.mods && report->usage == expected.usage;
+    for (uint8_t i = 0; i < KEYBOARD_KEYS && match; i++) {
+        uint8_t count_report = 0, count_expected = 0;
+        for (uint8_t j = 0; j < KEYBOARD_KEYS; j++) {
+            count_report += report->keys[j] == expected.keys[i];
+            count_expected += expected.keys[j] == expected.keys[i];
+        }
+        match = count_report == count_expected;
+    }
+    if (!match) {
+        report_format(report, got);
+        fail("expected [%s], got [%s]", want, got);
+    }
+}
+
+// The rest of the line after the command, a double-quoted string with \" and
+// \\ escapes.
+static void command_typed(const char *rest) {
+    char expected[MAX_TEXT];
+    text_checked = true;
+    while (isspace((unsigned char)*rest)) {
+        rest++;
+    }
+    if (*rest++ != '"') {
+        fail("expected typed \"TEXT\"");
+        return;
+    }
+    size_t length = 0;
+    while (*rest && *rest != '"' && length < MAX_TEXT - 1) {
+        if (*rest == '\\' && rest[1]) {
+            rest++;
+        }
+        expected[length++] = *rest++;
+    }
+    expected[length] = 0;
+    if (*rest != '"') {
+        fail("unterminated string");
+        return;
+    }
+    if (strcmp(text, expected) != 0) {
+        fail("typed \"%s\", expected \"%s\"", text, expected);
+    }
+    text_length = 0;
+    text[0]     = 0;
+}
+
+static void command_layers(char **args) {
+    uint32_t expected = 0;
+    for (; *args; args++) {
+        uint32_t layer;
+        if (!parse_number(*args, 10, 31, &layer)) {
+            fail("bad layer %s", *args);
+            return;
+        }
+        expected |= 1u << layer;
+    }
+    uint32_t state = device.layer_state();
+    if (state != expected) {
+        fail("layers 0x%08X, expected 0x%08X", state, expected);
+    }
+}
+
+// Splits line into whitespace-separated tokens in place, stopping at a comment
+// or, for typed, leaving the quoted rest alone.
+static uint8_t tokenize(char *line, char **tokens, uint8_t max, char **rest) {
+    uint8_t count = 0;
+    *rest         = NULL;
+    char *cursor  = line;
+    while (count < max - 1) {
+        while (isspace((unsigned char)*cursor)) {
+            cursor++;
+        }
+        if (!*cursor || *cursor == '#') {
+            break;
+        }
+        if (*cursor == '"') {
+            *rest = cursor;
+            break;
+        }
+        tokens[count++] = cursor;
+        while (*cursor && !isspace((unsigned char)*cursor)) {
+            cursor++;
+        }
+        if (*cursor) {
+            *cursor++ = 0;
+        }
+    }
+    tokens[count] = NULL;
+    return count;
+}
+
+static bool trace_run(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+    trace_name      = path;
+    trace_line      = 0;
+    now_us          = 0;
+    next_scan_us    = 0;
+    failed          = false;
+    report_head     = 0;
+    report_count    = 0;
+    reports_checked = false;
+    reports_dropped = false;
+    text_length     = 0;
+    text[0]         = 0;
+    text_checked    = false;
+    pending_events  = 0;
+    memset(last_keys, 0, sizeof(last_keys));
+
+    char     line[MAX_LINE];
+    uint32_t time_ms = 0;
+    while (!failed && fgets(line, sizeof(line), file)) {
+        char *tokens[MAX_TOKENS];
+        char *rest;
+        trace_line++;
+        uint8_t count = tokenize(line, tokens, MAX_TOKENS, &rest);
+        if (count == 0) {
+            continue;
+        }
+        char **args = tokens;
+        if (isdigit((unsigned char)args[0][0]) || args[0][0] == '+') {
+            uint32_t ms;
+            if (!parse_number(args[0] + (args[0][0] == '+'), 10, UINT32_MAX / 1000, &ms)) {
+                fail("bad time %s", args[0]);
+                break;
+            }
+            time_ms = args[0][0] == '+' ? time_ms + ms : ms;
+            args++;
+        }
+        if (time_ms * 1000 < now_us) {
+            fail("time goes backwards");
+            break;
+        }
+        run_until(time_ms * 1000);
+        if (!args[0]) {
+            continue;
+        }
+        if (strcmp(args[0], "down") == 0 || strcmp(args[0], "up") == 0) {
+            command_switch(args + 1, args[0][0] == 'd');
+        } else if (strcmp(args[0], "raw") == 0) {
+            command_raw(args + 1);
+        } else if (strcmp(args[0], "expect") == 0) {
+            command_expect(args + 1);
+        } else if (strcmp(args[0], "typed") == 0 && rest) {
+            command_typed(rest);
+        } else if (strcmp(args[0], "layers") == 0) {
+            command_layers(args + 1);
+        } else {
+            fail("unknown command %s", args[0]);
+        }
+    }
+    fclose(file);
+
+    if (!failed) {
+        run_until(now_us + SETTLE_MS * 1000);
+        trace_line++;
+        if (reports_checked && report_count) {
+            char got[64];
+            report_format(&reports[report_head], got);
+            fail("%u unexpected reports, first [%s]", report_count, got);
+        } else if (text_checked && text_length) {
+            fail("unexpected text \"%s\"", text);
+        }
+    }
+    return !failed;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-v] [-c scan_us] [-r repeat] keymap.so trace...\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    uint32_t repeat = 1;
+    int      opt;
+    while ((opt = getopt(argc, argv, "vc:r:")) != -1) {
+        switch (opt) {
+            case 'v':
+                verbose = true;
+                break;
+            case 'c':
+                scan_us = atoi(optarg);
+                break;
+            case 'r':
+                repeat = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (argc - optind < 2 || scan_us == 0 || repeat == 0) {
+        usage(argv[0]);
+    }
+    const char *keymap = argv[optind];
+
+    sim_host_t host = {
+        .keyboard_report = host_keyboard_report,
+        .extra_report    = host_extra_report,
+    };
+    uint32_t failures = 0;
+    printf("%-32s %7s %7s %9s %9s %s\n", "trace", "events", "scans", "ns/event", "ns/scan", "result");
+    for (int i = optind + 1; i < argc; i++) {
+        bool passed = true;
+        event_ns = idle_ns = 0;
+        events = idle_scans = 0;
+        for (uint32_t run = 0; run < repeat && passed; run++) {
+            if (!sim_load(&device, keymap)) {
+                return 1;
+            }
+            device.init(&host, 0);
+            passed = trace_run(argv[i]);
+            sim_unload(&device);
+        }
+        failures += !passed;
+        const char *name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+        printf("%-32s %7u %7u %9.0f %9.0f %s\n", name, events, events + idle_scans, events ? (double)event_ns / events : 0, idle_scans ? (double)idle_ns / idle_scans : 0, passed ? "ok" : "FAIL");
+    }
+    return failures ? 1 : 0;
+}
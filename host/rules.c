@@ -0,0 +1,301 @@
+// Reads and writes the runtime rules of windexlight devices built with
+// RUNTIME_RULES_ENABLE, over raw HID.
+//
+//     rules [/dev/hidrawN ...]             prints the saved rules
+//     rules -w FILE [/dev/hidrawN ...]     replaces them with FILE's, - for stdin
+//     rules -c [/dev/hidrawN ...]          clears them
+//
+// A rules file has one rule per line, '#' starts a comment:
+//
+//     alt      -   A     Z       # the magic key after A, without mods, sends Z
+//     alt      S   A     S(Z)    # and after Shift+A
+//     override S   COMM  SCLN    # Shift+, sends ;
+//     override S   DOT   TRNS    # Shift+. is left alone, whatever key_overrides[] says
+//
+// Mods are any of C, S, A and G, either side, or - for none. Keycodes are QMK
+// names for the basic keys, with or without KC_, S(...) for shifted ones, or
+// numbers. Without device paths every raw HID device that answers is used.
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hidraw.h"
+#include "raw_hid_commands.h"
+#include "runtime_rules.h"
+
+#define MAX_DEVICES 8
+#define REPLY_TIMEOUT_MS 500
+#define MAX_LINE 256
+
+// Keyboard usages 0x04..0x38 by QMK name.
+#define NAME_FIRST 0x04
+static const char *const names[] = {
+    "A",   "B",   "C",    "D",    "E",   "F",    "G",    "H",    "I",    "J",    "K",   "L",    "M",    "N",   "O",   "P",
+    "Q",   "R",   "S",    "T",    "U",   "V",    "W",    "X",    "Y",    "Z",    "1",   "2",    "3",    "4",   "5",   "6",
+    "7",   "8",   "9",    "0",    "ENT", "ESC",  "BSPC", "TAB",  "SPC",  "MINS", "EQL", "LBRC", "RBRC", "BSLS", "NUHS", "SCLN",
+    "QUOT", "GRV", "COMM", "DOT", "SLSH",
+};
+#define NAME_COUNT (sizeof(names) / sizeof(names[0]))
+
+// QMK's 8-bit mods, both sides of each.
+static const struct {
+    char    letter;
+    uint8_t mods;
+} mod_letters[] = {{'C', 0x11}, {'S', 0x22}, {'A', 0x44}, {'G', 0x88}};
+
+#define SHIFTED 0x0200 // LSFT() of a basic keycode
+
+static const char *paths[MAX_DEVICES];
+static int         path_count = 0;
+
+static void device_found(const char *path) {
+    if (path_count < MAX_DEVICES) {
+        paths[path_count++] = strdup(path);
+    }
+}
+
+static bool parse_keycode(const char *token, uint16_t *keycode) {
+    size_t length = strlen(token);
+    if (strncmp(token, "S(", 2) == 0 && length > 3 && token[length - 1] == ')') {
+        char inner[MAX_LINE];
+        snprintf(inner, sizeof(inner), "%.*s", (int)length - 3, token + 2);
+        if (!parse_keycode(inner, keycode) || *keycode > 0xFF) {
+            return false;
+        }
+        *keycode |= SHIFTED;
+        return true;
+    }
+    char         *end;
+    unsigned long value = strtoul(token, &end, 0);
+    if (*token && !*end) {
+        *keycode = value;
+        return value <= 0xFFFF;
+    }
+    const char *name = strncmp(token, "KC_", 3) == 0 ? token + 3 : token;
+    if (strcmp(name, "NO") == 0 || strcmp(name, "TRNS") == 0) {
+        *keycode = strcmp(name, "NO") == 0 ? 0x0000 : 0x0001;
+        return true;
+    }
+    for (size_t i = 0; i < NAME_COUNT; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *keycode = NAME_FIRST + i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static const char *keycode_name(uint16_t keycode) {
+    static char name[16];
+    uint8_t     basic = keycode & 0xFF;
+    if (keycode == 0x0000) {
+        return "NO";
+    } else if (keycode == 0x0001) {
+        return "TRNS";
+    } else if ((keycode & ~SHIFTED) == basic && basic >= NAME_FIRST && basic < NAME_FIRST + NAME_COUNT) {
+        snprintf(name, sizeof(name), keycode & SHIFTED ? "S(%s)" : "%s", names[basic - NAME_FIRST]);
+    } else {
+        snprintf(name, sizeof(name), "0x%04X", keycode);
+    }
+    return name;
+}
+
+static bool parse_mods(const char *token, uint8_t *mods) {
+    *mods = 0;
+    if (strcmp(token, "-") == 0) {
+        return true;
+    }
+    for (; *token; token++) {
+        size_t i = 0;
+        while (i < sizeof(mod_letters) / sizeof(mod_letters[0]) && mod_letters[i].letter != toupper((unsigned char)*token)) {
+            i++;
+        }
+        if (i == sizeof(mod_letters) / sizeof(mod_letters[0])) {
+            return false;
+        }
+        *mods |= mod_letters[i].mods;
+    }
+    return true;
+}
+
+static const char *mods_name(uint8_t mods) {
+    static char name[5];
+    int         length = 0;
+    for (size_t i = 0; i < sizeof(mod_letters) / sizeof(mod_letters[0]); i++) {
+        if (mods & mod_letters[i].mods) {
+            name[length++] = mod_letters[i].letter;
+        }
+    }
+    if (length == 0) {
+        name[length++] = '-';
+    }
+    name[length] = 0;
+    return name;
+}
+
+// Parses FILE into rules, returning how many, or -1 after printing the error.
+static int rules_parse(const char *path, runtime_rule_t *rules) {
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return -1;
+    }
+    char line[MAX_LINE];
+    int  count = 0;
+    for (int number = 1; fgets(line, sizeof(line), file); number++) {
+        char *comment = strchr(line, '#');
+        if (comment) {
+            *comment = 0;
+        }
+        char *kind = strtok(line, " \t\r\n");
+        if (!kind) {
+            continue;
+        }
+        char          *mods    = strtok(NULL, " \t\r\n");
+        char          *keycode = strtok(NULL, " \t\r\n");
+        char          *output  = strtok(NULL, " \t\r\n");
+        runtime_rule_t rule    = {0};
+        if (strcmp(kind, "alt") == 0) {
+            rule.kind = RUNTIME_RULE_ALT_REPEAT;
+        } else if (strcmp(kind, "override") == 0) {
+            rule.kind = RUNTIME_RULE_KEY_OVERRIDE;
+        }
+        uint8_t  mods_value;
+        uint16_t keycode_value, output_value;
+        if (!rule.kind || !output || strtok(NULL, " \t\r\n") || !parse_mods(mods, &mods_value) || !parse_keycode(keycode, &keycode_value) || !parse_keycode(output, &output_value)) {
+            fprintf(stderr, "%s:%d: expected alt|override MODS KEYCODE KEYCODE\n", path, number);
+            count = -1;
+            break;
+        }
+        if (count == RUNTIME_RULES_MAX) {
+            fprintf(stderr, "%s:%d: more than %d rules\n", path, number, RUNTIME_RULES_MAX);
+            count = -1;
+            break;
+        }
+        rule.mods      = mods_value;
+        rule.keycode   = keycode_value;
+        rule.output    = output_value;
+        rules[count++] = rule;
+    }
+    if (file != stdin) {
+        fclose(file);
+    }
+    return count;
+}
+
+// Reads the saved rules into rules, returning how many, or -1 without a reply.
+static int rules_read(int fd, runtime_rule_t *rules) {
+    int count = RUNTIME_RULES_PER_FRAME;
+    for (int index = 0; index < count; index += RUNTIME_RULES_PER_FRAME) {
+        uint8_t request[REPORT_SIZE] = {RAW_HID_CMD_RUNTIME_RULES, RUNTIME_RULES_READ, index};
+        uint8_t report[REPORT_SIZE];
+        if (!hidraw_write(fd, request) || !hidraw_read_reply(fd, RAW_HID_CMD_RUNTIME_RULES, report, REPLY_TIMEOUT_MS) || report[1] != RUNTIME_RULES_READ || report[2] != index || report[3] > RUNTIME_RULES_PER_FRAME || report[4] > RUNTIME_RULES_MAX) {
+            return -1;
+        }
+        count = report[4];
+        memcpy(&rules[index], &report[RUNTIME_RULES_FRAME_HEADER], report[3] * sizeof(runtime_rule_t));
+    }
+    return count;
+}
+
+// Stages rules and saves them; false if the device did not take them.
+static bool rules_write(int fd, const runtime_rule_t *rules, int count) {
+    for (int index = 0; index < count; index += RUNTIME_RULES_PER_FRAME) {
+        int     n                    = count - index < RUNTIME_RULES_PER_FRAME ? count - index : RUNTIME_RULES_PER_FRAME;
+        uint8_t request[REPORT_SIZE] = {RAW_HID_CMD_RUNTIME_RULES, RUNTIME_RULES_STAGE, index, n};
+        uint8_t report[REPORT_SIZE];
+        memcpy(&request[RUNTIME_RULES_FRAME_HEADER], &rules[index], n * sizeof(runtime_rule_t));
+        if (!hidraw_write(fd, request) || !hidraw_read_reply(fd, RAW_HID_CMD_RUNTIME_RULES, report, REPLY_TIMEOUT_MS) || report[1] != RUNTIME_RULES_STAGE || report[2] != index || !report[4]) {
+            return false;
+        }
+    }
+    uint8_t request[REPORT_SIZE] = {RAW_HID_CMD_RUNTIME_RULES, RUNTIME_RULES_SAVE, count};
+    uint8_t report[REPORT_SIZE];
+    return hidraw_write(fd, request) && hidraw_read_reply(fd, RAW_HID_CMD_RUNTIME_RULES, report, REPLY_TIMEOUT_MS) && report[1] == RUNTIME_RULES_SAVE && report[2];
+}
+
+static void rules_print(const char *path, const runtime_rule_t *rules, int count) {
+    printf("# %s: %d rules\n", path, count);
+    for (int i = 0; i < count; i++) {
+        const char *kind = rules[i].kind == RUNTIME_RULE_ALT_REPEAT ? "alt" : rules[i].kind == RUNTIME_RULE_KEY_OVERRIDE ? "override" : "?";
+        printf("%-8s %-4s %-8s", kind, mods_name(rules[i].mods), keycode_name(rules[i].keycode));
+        printf(" %s\n", keycode_name(rules[i].output));
+    }
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-w FILE | -c] [/dev/hidrawN ...]\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char    *file  = NULL;
+    bool           clear = false;
+    int            opt;
+    runtime_rule_t rules[RUNTIME_RULES_MAX];
+    int            count = 0;
+    while ((opt = getopt(argc, argv, "w:c")) != -1) {
+        switch (opt) {
+            case 'w':
+                file = optarg;
+                break;
+            case 'c':
+                clear = true;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (file && clear) {
+        usage(argv[0]);
+    }
+    if (file && (count = rules_parse(file, rules)) < 0) {
+        return 1;
+    }
+    bool scanned = optind == argc;
+    for (int i = optind; i < argc && path_count < MAX_DEVICES; i++) {
+        paths[path_count++] = argv[i];
+    }
+    if (scanned) {
+        hidraw_scan(device_found);
+        if (path_count == 0) {
+            fprintf(stderr, "no raw HID devices found\n");
+            return 1;
+        }
+    }
+
+    int status = 0;
+    for (int i = 0; i < path_count; i++) {
+        int fd = open(paths[i], O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+            perror(paths[i]);
+            return 1;
+        }
+        runtime_rule_t saved[RUNTIME_RULES_MAX + RUNTIME_RULES_PER_FRAME];
+        int            saved_count = rules_read(fd, saved);
+        if (saved_count < 0) {
+            // Scanned devices without runtime rules are left out quietly.
+            if (!scanned) {
+                fprintf(stderr, "%s: no runtime rules reply\n", paths[i]);
+                status = 1;
+            }
+        } else if (file || clear) {
+            if (!rules_write(fd, rules, count)) {
+                fprintf(stderr, "%s: rules not saved\n", paths[i]);
+                status = 1;
+            } else {
+                printf("%s: %d rules saved\n", paths[i], count);
+            }
+        } else {
+            rules_print(paths[i], saved, saved_count);
+        }
+        close(fd);
+    }
+    return status;
+}
@@ -0,0 +1,582 @@
+// Host-side stand-in for the QMK headers the windexlight keymaps and userspace
+// modules include. Keycode values, report layouts and action encodings follow
+// qmk_firmware, so keymaps compile unchanged and reports come out with real
+// usages. Only what this userspace uses is declared; sim.c implements it.
+#pragma once
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef MATRIX_ROWS
+#    error "MATRIX_ROWS is set by the keyboard header, see host/sim/keyboards"
+#endif
+
+#ifndef TAPPING_TERM
+#    define TAPPING_TERM 200
+#endif
+#ifndef QUICK_TAP_TERM
+#    define QUICK_TAP_TERM TAPPING_TERM
+#endif
+#ifndef TAP_CODE_DELAY
+#    define TAP_CODE_DELAY 0
+#endif
+#ifndef LEADER_TIMEOUT
+#    define LEADER_TIMEOUT 300
+#endif
+#ifndef CAPS_WORD_IDLE_TIMEOUT
+#    define CAPS_WORD_IDLE_TIMEOUT 5000
+#endif
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define pgm_read_ptr(p) (*(void *const *)(p))
+#define memcpy_P memcpy
+
+#define PACKED __attribute__((packed))
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+// usb_descriptor.h, report.h
+
+#define RAW_EPSIZE 32
+#define KEYBOARD_REPORT_KEYS 6
+#define NKRO_REPORT_BITS 30
+
+enum hid_report_ids {
+    REPORT_ID_ALL = 0,
+    REPORT_ID_KEYBOARD,
+    REPORT_ID_MOUSE,
+    REPORT_ID_SYSTEM,
+    REPORT_ID_CONSUMER,
+    REPORT_ID_PROGRAMMABLE_BUTTON,
+    REPORT_ID_NKRO,
+};
+
+typedef struct {
+    uint8_t mods;
+    uint8_t reserved;
+    uint8_t keys[KEYBOARD_REPORT_KEYS];
+} report_keyboard_t;
+
+typedef struct PACKED {
+    uint8_t report_id;
+    uint8_t mods;
+    uint8_t bits[NKRO_REPORT_BITS];
+} report_nkro_t;
+
+typedef struct PACKED {
+    uint8_t  report_id;
+    uint16_t usage;
+} report_extra_t;
+
+typedef struct {
+    uint8_t (*keyboard_leds)(void);
+    void (*send_keyboard)(report_keyboard_t *);
+    void (*send_nkro)(report_nkro_t *);
+    void (*send_mouse)(void *);
+    void (*send_extra)(report_extra_t *);
+} host_driver_t;
+
+enum system_usages {
+    SYSTEM_POWER_DOWN = 0x81,
+    SYSTEM_SLEEP      = 0x82,
+    SYSTEM_WAKE_UP    = 0x83,
+};
+
+enum consumer_usages {
+    BRIGHTNESS_UP               = 0x06F,
+    BRIGHTNESS_DOWN             = 0x070,
+    TRANSPORT_FAST_FORWARD      = 0x0B3,
+    TRANSPORT_REWIND            = 0x0B4,
+    TRANSPORT_NEXT_TRACK        = 0x0B5,
+    TRANSPORT_PREV_TRACK        = 0x0B6,
+    TRANSPORT_STOP              = 0x0B7,
+    TRANSPORT_STOP_EJECT        = 0x0CC,
+    TRANSPORT_PLAY_PAUSE        = 0x0CD,
+    AUDIO_MUTE                  = 0x0E2,
+    AUDIO_VOL_UP                = 0x0E9,
+    AUDIO_VOL_DOWN              = 0x0EA,
+    AL_CC_CONFIG                = 0x183,
+    AL_EMAIL                    = 0x18A,
+    AL_CALCULATOR               = 0x192,
+    AL_LOCAL_BROWSER            = 0x194,
+    AL_CONTROL_PANEL            = 0x19F,
+    AL_ASSISTANT                = 0x1CB,
+    AC_SEARCH                   = 0x221,
+    AC_HOME                     = 0x223,
+    AC_BACK                     = 0x224,
+    AC_FORWARD                  = 0x225,
+    AC_STOP                     = 0x226,
+    AC_REFRESH                  = 0x227,
+    AC_BOOKMARKS                = 0x22A,
+    AC_DESKTOP_SHOW_ALL_WINDOWS = 0x29F,
+    AC_SOFT_KEY_LEFT            = 0x2A0,
+};
+
+// keycodes.h
+
+enum qk_keycode_ranges {
+    QK_BASIC          = 0x0000,
+    QK_BASIC_MAX      = 0x00FF,
+    QK_MODS           = 0x0100,
+    QK_MODS_MAX       = 0x1FFF,
+    QK_MOD_TAP        = 0x2000,
+    QK_MOD_TAP_MAX    = 0x3FFF,
+    QK_LAYER_TAP      = 0x4000,
+    QK_LAYER_TAP_MAX  = 0x4FFF,
+    QK_TAP_DANCE      = 0x5700,
+    QK_TAP_DANCE_MAX  = 0x57FF,
+    QK_QUANTUM        = 0x7C00,
+    QK_QUANTUM_MAX    = 0x7DFF,
+    QK_USER           = 0x7E40,
+    QK_USER_MAX       = 0x7FFF,
+};
+
+enum qk_keycode_defines {
+    KC_NO   = 0x0000,
+    KC_TRNS = 0x0001,
+    KC_A    = 0x0004,
+    KC_B,
+    KC_C,
+    KC_D,
+    KC_E,
+    KC_F,
+    KC_G,
+    KC_H,
+    KC_I,
+    KC_J,
+    KC_K,
+    KC_L,
+    KC_M,
+    KC_N,
+    KC_O,
+    KC_P,
+    KC_Q,
+    KC_R,
+    KC_S,
+    KC_T,
+    KC_U,
+    KC_V,
+    KC_W,
+    KC_X,
+    KC_Y,
+    KC_Z,
+    KC_1,
+    KC_2,
+    KC_3,
+    KC_4,
+    KC_5,
+    KC_6,
+    KC_7,
+    KC_8,
+    KC_9,
+    KC_0,
+    KC_ENT,
+    KC_ESC,
+    KC_BSPC,
+    KC_TAB,
+    KC_SPC,
+    KC_MINS,
+    KC_EQL,
+    KC_LBRC,
+    KC_RBRC,
+    KC_BSLS,
+    KC_NUHS,
+    KC_SCLN,
+    KC_QUOT,
+    KC_GRV,
+    KC_COMM,
+    KC_DOT,
+    KC_SLSH,
+    KC_CAPS,
+    KC_F1,
+    KC_F2,
+    KC_F3,
+    KC_F4,
+    KC_F5,
+    KC_F6,
+    KC_F7,
+    KC_F8,
+    KC_F9,
+    KC_F10,
+    KC_F11,
+    KC_F12,
+    KC_PSCR,
+    KC_SCRL,
+    KC_PAUS,
+    KC_INS,
+    KC_HOME,
+    KC_PGUP,
+    KC_DEL,
+    KC_END,
+    KC_PGDN,
+    KC_RGHT,
+    KC_LEFT,
+    KC_DOWN,
+    KC_UP,
+    KC_NUM_LOCK,
+
+    KC_SYSTEM_POWER = 0x00A5,
+    KC_SYSTEM_SLEEP,
+    KC_SYSTEM_WAKE,
+    KC_AUDIO_MUTE,
+    KC_AUDIO_VOL_UP,
+    KC_AUDIO_VOL_DOWN,
+    KC_MEDIA_NEXT_TRACK,
+    KC_MEDIA_PREV_TRACK,
+    KC_MEDIA_STOP,
+    KC_MEDIA_PLAY_PAUSE,
+    KC_MEDIA_SELECT,
+    KC_MEDIA_EJECT,
+    KC_MAIL,
+    KC_CALCULATOR,
+    KC_MY_COMPUTER,
+    KC_WWW_SEARCH,
+    KC_WWW_HOME,
+    KC_WWW_BACK,
+    KC_WWW_FORWARD,
+    KC_WWW_STOP,
+    KC_WWW_REFRESH,
+    KC_WWW_FAVORITES,
+    KC_MEDIA_FAST_FORWARD,
+    KC_MEDIA_REWIND,
+    KC_BRIGHTNESS_UP,
+    KC_BRIGHTNESS_DOWN,
+    KC_CONTROL_PANEL,
+    KC_ASSISTANT,
+    KC_MISSION_CONTROL,
+    KC_LAUNCHPAD,
+
+    MS_BTN1 = 0x00D1,
+    MS_BTN2,
+    MS_BTN3,
+
+    KC_LCTL = 0x00E0,
+    KC_LSFT,
+    KC_LALT,
+    KC_LGUI,
+    KC_RCTL,
+    KC_RSFT,
+    KC_RALT,
+    KC_RGUI,
+
+    QK_LEAD = 0x7C58,
+    QK_REP  = 0x7C79,
+    QK_AREP = 0x7C7A,
+
+    SAFE_RANGE = QK_USER,
+};
+
+// 5-bit mods as encoded in keycodes.
+enum mods_5bit {
+    MOD_LCTL = 0x01,
+    MOD_LSFT = 0x02,
+    MOD_LALT = 0x04,
+    MOD_LGUI = 0x08,
+    MOD_RCTL = 0x11,
+    MOD_RSFT = 0x12,
+    MOD_RALT = 0x14,
+    MOD_RGUI = 0x18,
+};
+
+// 8-bit mods as in reports.
+enum mods_8bit {
+    MOD_BIT_LCTRL  = 0x01,
+    MOD_BIT_LSHIFT = 0x02,
+    MOD_BIT_LALT   = 0x04,
+    MOD_BIT_LGUI   = 0x08,
+    MOD_BIT_RCTRL  = 0x10,
+    MOD_BIT_RSHIFT = 0x20,
+    MOD_BIT_RALT   = 0x40,
+    MOD_BIT_RGUI   = 0x80,
+};
+
+#define MOD_BIT(code) (1 << ((code) & 0x07))
+#define MOD_MASK_CTRL (MOD_BIT_LCTRL | MOD_BIT_RCTRL)
+#define MOD_MASK_SHIFT (MOD_BIT_LSHIFT | MOD_BIT_RSHIFT)
+#define MOD_MASK_ALT (MOD_BIT_LALT | MOD_BIT_RALT)
+#define MOD_MASK_GUI (MOD_BIT_LGUI | MOD_BIT_RGUI)
+#define MOD_MASK_CG (MOD_MASK_CTRL | MOD_MASK_GUI)
+
+#define IS_MODIFIER_KEYCODE(code) ((code) >= KC_LCTL && (code) <= KC_RGUI)
+#define IS_QK_MODS(code) ((code) >= QK_MODS && (code) <= QK_MODS_MAX)
+#define IS_QK_MOD_TAP(code) ((code) >= QK_MOD_TAP && (code) <= QK_MOD_TAP_MAX)
+#define IS_QK_LAYER_TAP(code) ((code) >= QK_LAYER_TAP && (code) <= QK_LAYER_TAP_MAX)
+#define IS_QK_TAP_DANCE(code) ((code) >= QK_TAP_DANCE && (code) <= QK_TAP_DANCE_MAX)
+
+#define QK_MODS_GET_MODS(kc) (((kc) >> 8) & 0x1F)
+#define QK_MODS_GET_BASIC_KEYCODE(kc) ((kc) & 0xFF)
+#define QK_MOD_TAP_GET_MODS(kc) (((kc) >> 8) & 0x1F)
+#define QK_MOD_TAP_GET_TAP_KEYCODE(kc) ((kc) & 0xFF)
+#define QK_LAYER_TAP_GET_LAYER(kc) (((kc) >> 8) & 0x0F)
+#define QK_LAYER_TAP_GET_TAP_KEYCODE(kc) ((kc) & 0xFF)
+#define QK_TAP_DANCE_GET_INDEX(kc) ((kc) & 0xFF)
+
+#define LCTL(kc) ((MOD_LCTL << 8) | (kc))
+#define LSFT(kc) ((MOD_LSFT << 8) | (kc))
+#define LALT(kc) ((MOD_LALT << 8) | (kc))
+#define LGUI(kc) ((MOD_LGUI << 8) | (kc))
+#define S(kc) LSFT(kc)
+#define A(kc) LALT(kc)
+#define C(kc) LCTL(kc)
+#define G(kc) LGUI(kc)
+
+#define MT(mod, kc) (QK_MOD_TAP | (((mod) & 0x1F) << 8) | ((kc) & 0xFF))
+#define LCTL_T(kc) MT(MOD_LCTL, kc)
+#define LSFT_T(kc) MT(MOD_LSFT, kc)
+#define LALT_T(kc) MT(MOD_LALT, kc)
+#define LGUI_T(kc) MT(MOD_LGUI, kc)
+#define LT(layer, kc) (QK_LAYER_TAP | (((layer) & 0xF) << 8) | ((kc) & 0xFF))
+#define TD(i) (QK_TAP_DANCE | ((i) & 0xFF))
+
+#define KC_EXLM LSFT(KC_1)
+#define KC_AT LSFT(KC_2)
+#define KC_HASH LSFT(KC_3)
+#define KC_DLR LSFT(KC_4)
+#define KC_PERC LSFT(KC_5)
+#define KC_CIRC LSFT(KC_6)
+#define KC_AMPR LSFT(KC_7)
+#define KC_ASTR LSFT(KC_8)
+#define KC_LPRN LSFT(KC_9)
+#define KC_RPRN LSFT(KC_0)
+#define KC_UNDS LSFT(KC_MINS)
+#define KC_PLUS LSFT(KC_EQL)
+#define KC_LCBR LSFT(KC_LBRC)
+#define KC_RCBR LSFT(KC_RBRC)
+#define KC_PIPE LSFT(KC_BSLS)
+#define KC_COLN LSFT(KC_SCLN)
+#define KC_DQUO LSFT(KC_QUOT)
+#define KC_TILD LSFT(KC_GRV)
+#define KC_LABK LSFT(KC_COMM)
+#define KC_RABK LSFT(KC_DOT)
+#define KC_QUES LSFT(KC_SLSH)
+
+// keyboard.h, action.h
+
+typedef uint8_t  matrix_row_t;
+typedef uint32_t layer_state_t;
+
+typedef struct {
+    uint8_t col;
+    uint8_t row;
+} keypos_t;
+
+typedef enum {
+    TICK_EVENT = 0,
+    KEY_EVENT  = 1,
+} keyevent_type_t;
+
+typedef struct {
+    keypos_t        key;
+    uint16_t        time;
+    keyevent_type_t type;
+    bool            pressed;
+} keyevent_t;
+
+typedef struct {
+    bool    interrupted : 1;
+    bool    reserved2 : 1;
+    bool    reserved1 : 1;
+    bool    reserved0 : 1;
+    uint8_t count : 4;
+} tap_t;
+
+typedef struct {
+    keyevent_t event;
+    tap_t      tap;
+    uint16_t   keycode;
+} keyrecord_t;
+
+uint16_t timer_read(void);
+#define MAKE_KEYEVENT(row_num, col_num, press) ((keyevent_t){.key = (keypos_t){.row = (row_num), .col = (col_num)}, .pressed = (press), .time = (timer_read() | 1), .type = KEY_EVENT})
+
+typedef union {
+    uint16_t code;
+} action_t;
+
+// ACT_LAYER_TAP with OP_ON_OFF.
+#define ACTION_LAYER_MOMENTARY(layer) ((0xA << 12) | ((layer) << 8) | 0xF1)
+
+// process_tap_dance.h
+
+typedef struct {
+    uint16_t interrupting_keycode;
+    uint8_t  count;
+    uint8_t  weak_mods;
+    uint8_t  oneshot_mods;
+    bool     pressed : 1;
+    bool     finished : 1;
+    bool     interrupted : 1;
+} tap_dance_state_t;
+
+typedef void (*tap_dance_user_fn_t)(tap_dance_state_t *state, void *user_data);
+
+typedef struct {
+    struct {
+        tap_dance_user_fn_t on_each_tap;
+        tap_dance_user_fn_t on_dance_finished;
+        tap_dance_user_fn_t on_reset;
+        tap_dance_user_fn_t on_each_release;
+    } fn;
+    void *user_data;
+} tap_dance_action_t;
+
+#define ACTION_TAP_DANCE_FN(user_fn) \
+    { .fn = {NULL, user_fn, NULL, NULL}, .user_data = NULL }
+#define ACTION_TAP_DANCE_FN_ADVANCED_WITH_RELEASE(user_fn_on_each_tap, user_fn_on_each_release, user_fn_on_dance_finished, user_fn_on_dance_reset) \
+    { .fn = {user_fn_on_each_tap, user_fn_on_dance_finished, user_fn_on_dance_reset, user_fn_on_each_release}, .user_data = NULL }
+
+// process_key_override.h
+
+typedef struct {
+    uint16_t      trigger;
+    uint8_t       trigger_mods;
+    layer_state_t layers;
+    uint8_t       negative_mod_mask;
+    uint8_t       suppressed_mods;
+    uint16_t      replacement;
+} key_override_t;
+
+#define ko_make_with_layers_and_negmods(trigger_mods_, trigger_key, replacement_key, layer_mask, negative_mask) \
+    ((const key_override_t){.trigger = (trigger_key), .trigger_mods = (trigger_mods_), .layers = (layer_mask), .negative_mod_mask = (negative_mask), .suppressed_mods = (trigger_mods_), .replacement = (replacement_key)})
+#define ko_make_with_layers(trigger_mods, trigger_key, replacement_key, layer_mask) ko_make_with_layers_and_negmods(trigger_mods, trigger_key, replacement_key, layer_mask, 0)
+#define ko_make_basic(trigger_mods, trigger_key, replacement_key) ko_make_with_layers(trigger_mods, trigger_key, replacement_key, ~0)
+
+// send_string.h
+
+#define SS_QMK_PREFIX 1
+#define SS_TAP_CODE 1
+#define SS_DOWN_CODE 2
+#define SS_UP_CODE 3
+#define SS_DELAY_CODE 4
+
+#define X_LEFT 50
+#define X_DOWN 51
+#define X_UP 52
+
+#define STRINGIZE(z) #z
+#define ADD_SLASH_X(y) STRINGIZE(\x##y)
+#define SS_TAP(keycode) "\1\1" ADD_SLASH_X(keycode)
+#define SS_DOWN(keycode) "\1\2" ADD_SLASH_X(keycode)
+#define SS_UP(keycode) "\1\3" ADD_SLASH_X(keycode)
+
+#define SEND_STRING(string) send_string_P(PSTR(string))
+#define SEND_STRING_DELAY(string, interval) send_string_with_delay_P(PSTR(string), interval)
+
+// Keymap, supplied by the keymap and its introspection.
+extern const uint16_t keymaps[][MATRIX_ROWS][MATRIX_COLS];
+uint8_t               keymap_layer_count(void);
+uint16_t              keymap_key_to_keycode(uint8_t layer, keypos_t key);
+uint16_t              tap_dance_count(void);
+tap_dance_action_t   *tap_dance_get(uint16_t tap_dance_idx);
+uint16_t              key_override_count_raw(void);
+uint16_t              key_override_count(void);
+const key_override_t *key_override_get_raw(uint16_t key_override_idx);
+const key_override_t *key_override_get(uint16_t key_override_idx);
+
+// Timer, driven by the harness.
+uint32_t timer_read32(void);
+uint16_t timer_elapsed(uint16_t last);
+uint32_t timer_elapsed32(uint32_t last);
+void     wait_ms(uint16_t ms);
+
+// Layers.
+extern layer_state_t layer_state;
+extern layer_state_t default_layer_state;
+void                 layer_on(uint8_t layer);
+void                 layer_off(uint8_t layer);
+void                 layer_clear(void);
+void                 default_layer_set(layer_state_t state);
+void                 set_single_default_layer(uint8_t layer);
+uint8_t              get_highest_layer(layer_state_t state);
+bool                 layer_state_is(uint8_t layer);
+
+// Actions and mods.
+void     action_exec(keyevent_t event);
+void     process_action(keyrecord_t *record, action_t action);
+void     register_code(uint8_t code);
+void     unregister_code(uint8_t code);
+void     register_code16(uint16_t code);
+void     unregister_code16(uint16_t code);
+void     tap_code(uint8_t code);
+void     tap_code16(uint16_t code);
+uint8_t  get_mods(void);
+void     set_mods(uint8_t mods);
+void     add_mods(uint8_t mods);
+void     del_mods(uint8_t mods);
+void     clear_mods(void);
+void     register_mods(uint8_t mods);
+void     unregister_mods(uint8_t mods);
+uint8_t  get_weak_mods(void);
+void     set_weak_mods(uint8_t mods);
+void     add_weak_mods(uint8_t mods);
+void     del_weak_mods(uint8_t mods);
+void     clear_weak_mods(void);
+void     register_weak_mods(uint8_t mods);
+void     unregister_weak_mods(uint8_t mods);
+uint8_t  get_oneshot_mods(void);
+void     set_oneshot_mods(uint8_t mods);
+void     add_oneshot_mods(uint8_t mods);
+void     clear_oneshot_mods(void);
+void     add_key(uint8_t code);
+void     del_key(uint8_t code);
+void     clear_keys(void);
+void     send_keyboard_report(void);
+uint16_t get_tap_keycode(uint16_t keycode);
+
+// Host and raw HID.
+host_driver_t *host_get_driver(void);
+void           host_system_send(uint16_t usage);
+void           host_consumer_send(uint16_t usage);
+void           raw_hid_send(uint8_t *data, uint8_t length);
+void           raw_hid_receive(uint8_t *data, uint8_t length);
+matrix_row_t   matrix_get_row(uint8_t row);
+void           bootloader_jump(void);
+
+// EEPROM, the user datablock only. It starts zeroed with each keymap object.
+void eeconfig_read_user_datablock(void *data, uint32_t offset, uint32_t length);
+void eeconfig_update_user_datablock(const void *data, uint32_t offset, uint32_t length);
+
+// Features.
+bool     is_caps_word_on(void);
+void     caps_word_on(void);
+void     caps_word_off(void);
+void     caps_word_toggle(void);
+int8_t   get_repeat_key_count(void);
+uint16_t get_last_keycode(void);
+uint8_t  get_last_mods(void);
+void     set_last_keycode(uint16_t keycode);
+void     set_last_mods(uint8_t mods);
+bool     leader_sequence_active(void);
+bool     leader_sequence_timed_out(void);
+bool     leader_sequence_one_key(uint16_t kc);
+bool     leader_sequence_two_keys(uint16_t kc1, uint16_t kc2);
+bool     leader_sequence_three_keys(uint16_t kc1, uint16_t kc2, uint16_t kc3);
+
+void    send_string(const char *string);
+void    send_string_P(const char *string);
+void    send_string_with_delay(const char *string, uint8_t interval);
+void    send_string_with_delay_P(const char *string, uint8_t interval);
+void    send_char(char ascii_code);
+extern const uint8_t ascii_to_keycode_lut[128];
+extern const uint8_t ascii_to_shift_lut[16];
+
+void uprintf(const char *format, ...);
+
+// Callbacks, weak in sim.c.
+bool     pre_process_record_user(uint16_t keycode, keyrecord_t *record);
+bool     process_record_user(uint16_t keycode, keyrecord_t *record);
+void     keyboard_post_init_user(void);
+void     housekeeping_task_user(void);
+uint16_t get_tapping_term(uint16_t keycode, keyrecord_t *record);
+bool     remember_last_key_user(uint16_t keycode, keyrecord_t *record, uint8_t *remembered_mods);
+uint16_t get_alt_repeat_key_keycode_user(uint16_t keycode, uint8_t mods);
+bool     caps_word_press_user(uint16_t keycode);
+void     caps_word_set_user(bool active);
+void     leader_start_user(void);
+void     leader_end_user(void);
@@ -0,0 +1,35 @@
+// Compiles the keymap the way QMK's keymap_introspection.c does, so the sizes
+// of the keymap's arrays are available to sim.c.
+#include KEYMAP_C
+
+uint8_t keymap_layer_count(void) {
+    return ARRAY_SIZE(keymaps);
+}
+
+#ifdef TAP_DANCE_ENABLE
+uint16_t tap_dance_count(void) {
+    return ARRAY_SIZE(tap_dance_actions);
+}
+
+tap_dance_action_t *tap_dance_get(uint16_t tap_dance_idx) {
+    return tap_dance_idx < tap_dance_count() ? &tap_dance_actions[tap_dance_idx] : NULL;
+}
+#endif
+
+#ifdef KEY_OVERRIDE_ENABLE
+uint16_t key_override_count_raw(void) {
+    return ARRAY_SIZE(key_overrides);
+}
+
+__attribute__((weak)) uint16_t key_override_count(void) {
+    return key_override_count_raw();
+}
+
+const key_override_t *key_override_get_raw(uint16_t key_override_idx) {
+    return key_override_idx < key_override_count_raw() ? key_overrides[key_override_idx] : NULL;
+}
+
+__attribute__((weak)) const key_override_t *key_override_get(uint16_t key_override_idx) {
+    return key_override_get_raw(key_override_idx);
+}
+#endif
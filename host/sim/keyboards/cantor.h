@@ -0,0 +1,24 @@
+// Cantor: split 3x6+3, each half a 4x6 direct-pin matrix. Positions follow the
+// diagram in keymaps/windexlight/keymap.c, right half rows 4-7.
+#pragma once
+
+#define MATRIX_ROWS 8
+#define MATRIX_COLS 6
+
+// clang-format off
+#define LAYOUT_split_3x6_3( \
+    L00, L01, L02, L03, L04, L05,     R00, R01, R02, R03, R04, R05, \
+    L10, L11, L12, L13, L14, L15,     R10, R11, R12, R13, R14, R15, \
+    L20, L21, L22, L23, L24, L25,     R20, R21, R22, R23, R24, R25, \
+                   L30, L31, L32,     R30, R31, R32 \
+) { \
+    {L00, L01, L02, L03, L04, L05}, \
+    {L10, L11, L12, L13, L14, L15}, \
+    {L20, L21, L22, L23, L24, L25}, \
+    {L30, L31, L32, KC_NO, KC_NO, KC_NO}, \
+    {R00, R01, R02, R03, R04, R05}, \
+    {R10, R11, R12, R13, R14, R15}, \
+    {R20, R21, R22, R23, R24, R25}, \
+    {R30, R31, R32, KC_NO, KC_NO, KC_NO}, \
+}
+// clang-format on
@@ -0,0 +1,10 @@
+#include "quantum.h"
+#include "sim.h"
+
+// Drag scroll lives in the Ploopy keyboard code, which the keymap drives
+// through is_drag_scroll.
+bool is_drag_scroll = false;
+
+SIM_EXPORT bool sim_drag_scroll(void) {
+    return is_drag_scroll;
+}
@@ -0,0 +1,8 @@
+// Ploopy Madromys: six buttons on a single row.
+#pragma once
+
+#define MATRIX_ROWS 1
+#define MATRIX_COLS 6
+
+#define LAYOUT(k00, k01, k02, k03, k04, k05) \
+    { {k00, k01, k02, k03, k04, k05} }
@@ -0,0 +1,39 @@
+#include "sim.h"
+#include <dlfcn.h>
+#include <stdio.h>
+#include <string.h>
+
+// RTLD_LOCAL keeps each keymap's symbols to itself, so two keymaps defining
+// the same callbacks can be loaded side by side.
+bool sim_load(sim_device_t *device, const char *path) {
+    memset(device, 0, sizeof(*device));
+    device->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!device->handle) {
+        fprintf(stderr, "%s\n", dlerror());
+        return false;
+    }
+    device->init            = (void (*)(const sim_host_t *, uint32_t))sim_symbol(device, "sim_init");
+    device->set_time        = (void (*)(uint32_t))sim_symbol(device, "sim_set_time");
+    device->time            = (uint32_t(*)(void))sim_symbol(device, "sim_time");
+    device->matrix_set      = (void (*)(uint8_t, uint8_t, bool))sim_symbol(device, "sim_matrix_set");
+    device->scan            = (void (*)(void))sim_symbol(device, "sim_scan");
+    device->raw_hid_receive = (void (*)(const uint8_t *, uint8_t))sim_symbol(device, "sim_raw_hid_receive");
+    device->layer_state     = (uint32_t(*)(void))sim_symbol(device, "sim_layer_state");
+    if (!device->init || !device->set_time || !device->time || !device->matrix_set || !device->scan || !device->raw_hid_receive || !device->layer_state) {
+        fprintf(stderr, "%s: not a keymap object\n", path);
+        sim_unload(device);
+        return false;
+    }
+    return true;
+}
+
+void sim_unload(sim_device_t *device) {
+    if (device->handle) {
+        dlclose(device->handle);
+    }
+    memset(device, 0, sizeof(*device));
+}
+
+void *sim_symbol(sim_device_t *device, const char *name) {
+    return dlsym(device->handle, name);
+}
@@ -0,0 +1,1216 @@
+// Host-side stand-in for the QMK core, linked into each keymap object. It
+// covers what the windexlight keymaps rely on: keymap lookup through the layer
+// stack, basic and modified keycodes, mod-tap and layer-tap, layer actions,
+// repeat key, Caps Word, key overrides, tap dance, leader, 6KRO and extra
+// reports through the host driver, send_string, raw HID and a timer driven by
+// the harness.
+//
+// Tap-hold keys resolve as in QMK with PERMISSIVE_HOLD: a tap if released
+// first, a hold once the tapping term passes or another key is tapped within
+// it. Flow tap, chordal hold, speculative hold and quick tap are not modelled.
+
+#include "quantum.h"
+#include "raw_hid_queue.h"
+#include "sim.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+static sim_host_t host;
+static uint32_t   now_us     = 0;
+static uint32_t   last_in_us = 0;
+static bool       in_sent    = false;
+
+// Timer
+
+SIM_EXPORT void sim_set_time(uint32_t time_us) {
+    if ((int32_t)(time_us - now_us) > 0) {
+        now_us = time_us;
+    }
+}
+
+SIM_EXPORT uint32_t sim_time(void) {
+    return now_us;
+}
+
+uint16_t timer_read(void) {
+    return now_us / 1000;
+}
+
+uint32_t timer_read32(void) {
+    return now_us / 1000;
+}
+
+uint16_t timer_elapsed(uint16_t last) {
+    return timer_read() - last;
+}
+
+uint32_t timer_elapsed32(uint32_t last) {
+    return timer_read32() - last;
+}
+
+void wait_ms(uint16_t ms) {
+    now_us += ms * 1000;
+}
+
+// Callbacks the keymap may override
+
+__attribute__((weak)) bool process_record_user(uint16_t keycode, keyrecord_t *record) {
+    return true;
+}
+
+__attribute__((weak)) bool pre_process_record_user(uint16_t keycode, keyrecord_t *record) {
+    return true;
+}
+
+__attribute__((weak)) void keyboard_post_init_user(void) {}
+
+__attribute__((weak)) void housekeeping_task_user(void) {}
+
+__attribute__((weak)) uint16_t get_tapping_term(uint16_t keycode, keyrecord_t *record) {
+    return TAPPING_TERM;
+}
+
+static uint16_t tapping_term(uint16_t keycode, keyrecord_t *record) {
+#ifdef TAPPING_TERM_PER_KEY
+    return get_tapping_term(keycode, record);
+#else
+    return TAPPING_TERM;
+#endif
+}
+
+// Layers
+
+layer_state_t layer_state         = 0;
+layer_state_t default_layer_state = 1;
+
+SIM_EXPORT uint32_t sim_layer_state(void) {
+    return layer_state;
+}
+
+uint8_t get_highest_layer(layer_state_t state) {
+    return state ? 31 - __builtin_clz(state) : 0;
+}
+
+bool layer_state_is(uint8_t layer) {
+    return (layer_state | default_layer_state) & ((layer_state_t)1 << layer);
+}
+
+void layer_on(uint8_t layer) {
+    layer_state |= (layer_state_t)1 << layer;
+}
+
+void layer_off(uint8_t layer) {
+    layer_state &= ~((layer_state_t)1 << layer);
+}
+
+void layer_clear(void) {
+    layer_state = 0;
+}
+
+void default_layer_set(layer_state_t state) {
+    default_layer_state = state;
+}
+
+void set_single_default_layer(uint8_t layer) {
+    default_layer_set((layer_state_t)1 << layer);
+}
+
+uint16_t keymap_key_to_keycode(uint8_t layer, keypos_t key) {
+    if (layer >= keymap_layer_count() || key.row >= MATRIX_ROWS || key.col >= MATRIX_COLS) {
+        return KC_NO;
+    }
+    return pgm_read_word(&keymaps[layer][key.row][key.col]);
+}
+
+static uint16_t keycode_at(keypos_t key) {
+    layer_state_t layers = layer_state | default_layer_state;
+    while (layers) {
+        uint8_t  layer   = get_highest_layer(layers);
+        uint16_t keycode = keymap_key_to_keycode(layer, key);
+        if (keycode != KC_TRNS) {
+            return keycode;
+        }
+        layers &= ~((layer_state_t)1 << layer);
+    }
+    return KC_NO;
+}
+
+uint16_t get_tap_keycode(uint16_t keycode) {
+    if (IS_QK_MOD_TAP(keycode)) {
+        return QK_MOD_TAP_GET_TAP_KEYCODE(keycode);
+    }
+    if (IS_QK_LAYER_TAP(keycode)) {
+        return QK_LAYER_TAP_GET_TAP_KEYCODE(keycode);
+    }
+    return keycode;
+}
+
+// Mods
+
+static uint8_t real_mods       = 0;
+static uint8_t weak_mods       = 0;
+static uint8_t oneshot_mods    = 0;
+static uint8_t suppressed_mods = 0; // held back from reports by a key override
+
+uint8_t get_mods(void) {
+    return real_mods;
+}
+
+void set_mods(uint8_t mods) {
+    real_mods = mods;
+}
+
+void add_mods(uint8_t mods) {
+    real_mods |= mods;
+}
+
+void del_mods(uint8_t mods) {
+    real_mods &= ~mods;
+}
+
+void clear_mods(void) {
+    real_mods = 0;
+}
+
+uint8_t get_weak_mods(void) {
+    return weak_mods;
+}
+
+void set_weak_mods(uint8_t mods) {
+    weak_mods = mods;
+}
+
+void add_weak_mods(uint8_t mods) {
+    weak_mods |= mods;
+}
+
+void del_weak_mods(uint8_t mods) {
+    weak_mods &= ~mods;
+}
+
+void clear_weak_mods(void) {
+    weak_mods = 0;
+}
+
+uint8_t get_oneshot_mods(void) {
+    return oneshot_mods;
+}
+
+void set_oneshot_mods(uint8_t mods) {
+    oneshot_mods = mods;
+}
+
+void add_oneshot_mods(uint8_t mods) {
+    oneshot_mods |= mods;
+}
+
+void clear_oneshot_mods(void) {
+    oneshot_mods = 0;
+}
+
+// Keycodes carry 5-bit mods, reports 8-bit ones.
+static uint8_t mod_config_8bit(uint8_t mods) {
+    return mods & 0x10 ? (mods & 0x0F) << 4 : mods & 0x0F;
+}
+
+// Host driver and reports
+
+static void driver_send_keyboard(report_keyboard_t *report) {
+    if (host.keyboard_report) {
+        host.keyboard_report(host.context, report->mods, report->keys);
+    }
+}
+
+static void driver_send_nkro(report_nkro_t *report) {}
+
+static void driver_send_mouse(void *report) {}
+
+static void driver_send_extra(report_extra_t *report) {
+    if (host.extra_report) {
+        host.extra_report(host.context, report->report_id, report->usage);
+    }
+}
+
+static uint8_t driver_keyboard_leds(void) {
+    return 0;
+}
+
+// The keymap hooks the ChibiOS driver directly, so the name is kept.
+host_driver_t chibios_driver = {driver_keyboard_leds, driver_send_keyboard, driver_send_nkro, driver_send_mouse, driver_send_extra};
+
+host_driver_t *host_get_driver(void) {
+    return &chibios_driver;
+}
+
+static report_keyboard_t keyboard_report;
+
+void add_key(uint8_t code) {
+    uint8_t *empty = NULL;
+    for (uint8_t i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+        if (keyboard_report.keys[i] == code) {
+            return;
+        }
+        if (!empty && keyboard_report.keys[i] == 0) {
+            empty = &keyboard_report.keys[i];
+        }
+    }
+    if (empty) {
+        *empty = code;
+    }
+}
+
+void del_key(uint8_t code) {
+    for (uint8_t i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+        if (keyboard_report.keys[i] == code) {
+            keyboard_report.keys[i] = 0;
+        }
+    }
+}
+
+void clear_keys(void) {
+    memset(keyboard_report.keys, 0, sizeof(keyboard_report.keys));
+}
+
+// Like QMK, unchanged reports are not sent.
+void send_keyboard_report(void) {
+    static report_keyboard_t last_report;
+    keyboard_report.mods = ((real_mods | oneshot_mods) & ~suppressed_mods) | weak_mods;
+    if (memcmp(&keyboard_report, &last_report, sizeof(keyboard_report)) != 0) {
+        last_report = keyboard_report;
+        host_get_driver()->send_keyboard(&keyboard_report);
+    }
+}
+
+static void host_extra_send(uint8_t report_id, uint16_t usage, uint16_t *last_usage) {
+    if (usage == *last_usage) {
+        return;
+    }
+    *last_usage           = usage;
+    report_extra_t report = {.report_id = report_id, .usage = usage};
+    host_get_driver()->send_extra(&report);
+}
+
+void host_system_send(uint16_t usage) {
+    static uint16_t last_usage = 0;
+    host_extra_send(REPORT_ID_SYSTEM, usage, &last_usage);
+}
+
+void host_consumer_send(uint16_t usage) {
+    static uint16_t last_usage = 0;
+    host_extra_send(REPORT_ID_CONSUMER, usage, &last_usage);
+}
+
+// KC_SYSTEM_POWER..KC_LAUNCHPAD, in keycode order.
+static const uint16_t extra_usages[] = {
+    SYSTEM_POWER_DOWN,      SYSTEM_SLEEP,         SYSTEM_WAKE_UP,   AUDIO_MUTE,       AUDIO_VOL_UP,     AUDIO_VOL_DOWN,     TRANSPORT_NEXT_TRACK, TRANSPORT_PREV_TRACK,
+    TRANSPORT_STOP,         TRANSPORT_PLAY_PAUSE, AL_CC_CONFIG,     TRANSPORT_STOP_EJECT, AL_EMAIL,     AL_CALCULATOR,      AL_LOCAL_BROWSER,     AC_SEARCH,
+    AC_HOME,                AC_BACK,              AC_FORWARD,       AC_STOP,          AC_REFRESH,       AC_BOOKMARKS,       TRANSPORT_FAST_FORWARD, TRANSPORT_REWIND,
+    BRIGHTNESS_UP,          BRIGHTNESS_DOWN,      AL_CONTROL_PANEL, AL_ASSISTANT,     AC_DESKTOP_SHOW_ALL_WINDOWS, AC_SOFT_KEY_LEFT,
+};
+static_assert(ARRAY_SIZE(extra_usages) == KC_LAUNCHPAD - KC_SYSTEM_POWER + 1, "extra_usages out of sync with the keycodes");
+
+void register_code(uint8_t code) {
+    if (code == KC_NO) {
+        return;
+    } else if (IS_MODIFIER_KEYCODE(code)) {
+        add_mods(MOD_BIT(code));
+        send_keyboard_report();
+    } else if (code >= KC_SYSTEM_POWER && code <= KC_SYSTEM_WAKE) {
+        host_system_send(extra_usages[code - KC_SYSTEM_POWER]);
+    } else if (code > KC_SYSTEM_WAKE && code <= KC_LAUNCHPAD) {
+        host_consumer_send(extra_usages[code - KC_SYSTEM_POWER]);
+    } else if (code < KC_SYSTEM_POWER) {
+        add_key(code);
+        send_keyboard_report();
+    }
+}
+
+void unregister_code(uint8_t code) {
+    if (code == KC_NO) {
+        return;
+    } else if (IS_MODIFIER_KEYCODE(code)) {
+        del_mods(MOD_BIT(code));
+        send_keyboard_report();
+    } else if (code >= KC_SYSTEM_POWER && code <= KC_SYSTEM_WAKE) {
+        host_system_send(0);
+    } else if (code > KC_SYSTEM_WAKE && code <= KC_LAUNCHPAD) {
+        host_consumer_send(0);
+    } else if (code < KC_SYSTEM_POWER) {
+        del_key(code);
+        send_keyboard_report();
+    }
+}
+
+void register_mods(uint8_t mods) {
+    if (mods) {
+        add_mods(mods);
+        send_keyboard_report();
+    }
+}
+
+void unregister_mods(uint8_t mods) {
+    if (mods) {
+        del_mods(mods);
+        send_keyboard_report();
+    }
+}
+
+void register_weak_mods(uint8_t mods) {
+    if (mods) {
+        add_weak_mods(mods);
+        send_keyboard_report();
+    }
+}
+
+void unregister_weak_mods(uint8_t mods) {
+    if (mods) {
+        del_weak_mods(mods);
+        send_keyboard_report();
+    }
+}
+
+void register_code16(uint16_t code) {
+    uint8_t mods = mod_config_8bit(QK_MODS_GET_MODS(code));
+    if (IS_MODIFIER_KEYCODE(code) || code == KC_NO) {
+        register_mods(mods);
+    } else {
+        register_weak_mods(mods);
+    }
+    register_code(code);
+}
+
+void unregister_code16(uint16_t code) {
+    uint8_t mods = mod_config_8bit(QK_MODS_GET_MODS(code));
+    unregister_code(code);
+    if (IS_MODIFIER_KEYCODE(code) || code == KC_NO) {
+        unregister_mods(mods);
+    } else {
+        unregister_weak_mods(mods);
+    }
+}
+
+void tap_code(uint8_t code) {
+    register_code(code);
+    wait_ms(TAP_CODE_DELAY);
+    unregister_code(code);
+}
+
+void tap_code16(uint16_t code) {
+    register_code16(code);
+    wait_ms(TAP_CODE_DELAY);
+    unregister_code16(code);
+}
+
+void bootloader_jump(void) {}
+
+void uprintf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+// send_string
+
+// US ANSI, as QMK's default tables. Shift is one bit per character.
+const uint8_t ascii_to_keycode_lut[128] = {
+    KC_NO, KC_NO, KC_NO, KC_NO, KC_NO, KC_NO, KC_NO, KC_NO,
+    KC_BSPC, KC_TAB, KC_ENT, KC_NO, KC_NO, KC_NO, KC_NO, KC_NO,
+    KC_NO, KC_NO, KC_NO, KC_NO, KC_NO, KC_NO, KC_NO, KC_NO,
+    KC_NO, KC_NO, KC_NO, KC_ESC, KC_NO, KC_NO, KC_NO, KC_NO,
+    KC_SPC, KC_1, KC_QUOT, KC_3, KC_4, KC_5, KC_7, KC_QUOT,
+    KC_9, KC_0, KC_8, KC_EQL, KC_COMM, KC_MINS, KC_DOT, KC_SLSH,
+    KC_0, KC_1, KC_2, KC_3, KC_4, KC_5, KC_6, KC_7,
+    KC_8, KC_9, KC_SCLN, KC_SCLN, KC_COMM, KC_EQL, KC_DOT, KC_SLSH,
+    KC_2, KC_A, KC_B, KC_C, KC_D, KC_E, KC_F, KC_G,
+    KC_H, KC_I, KC_J, KC_K, KC_L, KC_M, KC_N, KC_O,
+    KC_P, KC_Q, KC_R, KC_S, KC_T, KC_U, KC_V, KC_W,
+    KC_X, KC_Y, KC_Z, KC_LBRC, KC_BSLS, KC_RBRC, KC_6, KC_MINS,
+    KC_GRV, KC_A, KC_B, KC_C, KC_D, KC_E, KC_F, KC_G,
+    KC_H, KC_I, KC_J, KC_K, KC_L, KC_M, KC_N, KC_O,
+    KC_P, KC_Q, KC_R, KC_S, KC_T, KC_U, KC_V, KC_W,
+    KC_X, KC_Y, KC_Z, KC_LBRC, KC_BSLS, KC_RBRC, KC_GRV, KC_DEL,
+};
+
+const uint8_t ascii_to_shift_lut[16] = {
+    0x00, 0x00, 0x00, 0x00, 0x7E, 0x0F, 0x00, 0xD4,
+    0xFF, 0xFF, 0xFF, 0xC7, 0x00, 0x00, 0x00, 0x78,
+};
+
+void send_char(char ascii_code) {
+    bool shifted = (ascii_to_shift_lut[(uint8_t)ascii_code / 8] >> ((uint8_t)ascii_code % 8)) & 1;
+    if (shifted) {
+        register_code(KC_LSFT);
+    }
+    tap_code(ascii_to_keycode_lut[(uint8_t)ascii_code & 0x7F]);
+    if (shifted) {
+        unregister_code(KC_LSFT);
+    }
+}
+
+void send_string_with_delay(const char *string, uint8_t interval) {
+    while (*string) {
+        char character = *string++;
+        if (character == SS_QMK_PREFIX) {
+            uint8_t code = *string++;
+            if (code == SS_DELAY_CODE) {
+                uint16_t ms = 0;
+                while (*string >= '0' && *string <= '9') {
+                    ms = ms * 10 + (*string++ - '0');
+                }
+                if (*string == '|') {
+                    string++;
+                }
+                wait_ms(ms);
+                continue;
+            }
+            uint8_t keycode = *string++;
+            if (code == SS_TAP_CODE) {
+                tap_code(keycode);
+            } else if (code == SS_DOWN_CODE) {
+                register_code(keycode);
+            } else if (code == SS_UP_CODE) {
+                unregister_code(keycode);
+            }
+        } else {
+            send_char(character);
+        }
+        wait_ms(interval);
+    }
+}
+
+void send_string_with_delay_P(const char *string, uint8_t interval) {
+    send_string_with_delay(string, interval);
+}
+
+void send_string(const char *string) {
+    send_string_with_delay(string, TAP_CODE_DELAY);
+}
+
+void send_string_P(const char *string) {
+    send_string_with_delay(string, TAP_CODE_DELAY);
+}
+
+// Features. Each follows its QMK counterpart closely enough for the keymaps'
+// callbacks to see the same sequence of calls; the options the keymaps do not
+// use are left out.
+
+static void process_record(keyrecord_t *record);
+
+static bool keypos_equal(keypos_t a, keypos_t b) {
+    return a.row == b.row && a.col == b.col;
+}
+
+// Repeat key
+
+#ifdef REPEAT_KEY_ENABLE
+static keyrecord_t last_record;
+static uint8_t     last_mods               = 0;
+static int8_t      last_repeat_count       = 0;
+static int8_t      processing_repeat_count = 0;
+
+__attribute__((weak)) bool remember_last_key_user(uint16_t keycode, keyrecord_t *record, uint8_t *remembered_mods) {
+    return true;
+}
+
+__attribute__((weak)) uint16_t get_alt_repeat_key_keycode_user(uint16_t keycode, uint8_t mods) {
+    return KC_TRNS;
+}
+
+int8_t get_repeat_key_count(void) {
+    return processing_repeat_count;
+}
+
+uint16_t get_last_keycode(void) {
+    return last_record.keycode;
+}
+
+uint8_t get_last_mods(void) {
+    return last_mods;
+}
+
+void set_last_keycode(uint16_t keycode) {
+    last_record       = (keyrecord_t){.event.pressed = true, .tap.count = 1, .keycode = keycode};
+    last_repeat_count = 0;
+}
+
+void set_last_mods(uint8_t mods) {
+    last_mods = mods;
+}
+
+static bool process_last_key(uint16_t keycode, keyrecord_t *record) {
+    if (get_repeat_key_count() || !record->event.pressed) {
+        return true;
+    }
+    if ((IS_QK_MOD_TAP(keycode) || IS_QK_LAYER_TAP(keycode)) && record->tap.count == 0) {
+        return true; // holds are not remembered
+    }
+    switch (keycode) {
+        case KC_NO:
+        case KC_TRNS:
+        case KC_LCTL ... KC_RGUI:
+        case QK_LEAD:
+        case QK_REP:
+        case QK_AREP:
+            return true;
+    }
+    uint8_t remembered_mods = get_mods() | get_weak_mods() | get_oneshot_mods();
+    if (remember_last_key_user(keycode, record, &remembered_mods)) {
+        last_record         = *record;
+        last_record.keycode = keycode;
+        last_repeat_count   = 0;
+        last_mods           = remembered_mods;
+    }
+    return true;
+}
+
+// Counts up for repeats and down for alternate repeats, restarting when the
+// direction changes.
+static void update_last_repeat_count(int8_t direction) {
+    if (direction * last_repeat_count < 0) {
+        last_repeat_count = direction;
+    } else if (last_repeat_count > -127 && last_repeat_count < 127) {
+        last_repeat_count += direction;
+    }
+}
+
+// As in quantum/repeat_key.c, the user callback sees the last keycode as it
+// was, KC_HASH as LSFT(KC_3); only the defaults after it unpack QK_MODS.
+static uint16_t get_alt_repeat_key_keycode(void) {
+    uint16_t keycode     = last_record.keycode;
+    uint16_t alt_keycode = get_alt_repeat_key_keycode_user(keycode, last_mods);
+    if (alt_keycode != KC_TRNS) {
+        return alt_keycode;
+    }
+    if (IS_QK_MODS(keycode)) {
+        keycode = QK_MODS_GET_BASIC_KEYCODE(keycode);
+    }
+    // The navigation pairs of QMK's default table.
+    switch (get_tap_keycode(keycode)) {
+        case KC_LEFT:
+            return KC_RGHT;
+        case KC_RGHT:
+            return KC_LEFT;
+        case KC_UP:
+            return KC_DOWN;
+        case KC_DOWN:
+            return KC_UP;
+        case KC_HOME:
+            return KC_END;
+        case KC_END:
+            return KC_HOME;
+        case KC_PGUP:
+            return KC_PGDN;
+        case KC_PGDN:
+            return KC_PGUP;
+    }
+    return KC_NO;
+}
+
+// The repeated key goes through the whole pipeline again, so press and release
+// are both replayed from the record saved at the press.
+static void repeat_key_invoke(keyrecord_t *registered, int8_t *registered_count, const keyevent_t *event, bool alternate) {
+    if (processing_repeat_count) {
+        return;
+    }
+    if (event->pressed) {
+        if (alternate) {
+            *registered = (keyrecord_t){.tap.count = 1, .keycode = get_alt_repeat_key_keycode()};
+        } else {
+            *registered = last_record;
+        }
+        if (!registered->keycode) {
+            return;
+        }
+        update_last_repeat_count(alternate ? -1 : 1);
+        *registered_count = last_repeat_count;
+        if (!alternate) {
+            register_weak_mods(last_mods);
+        }
+    } else if (!registered->keycode) {
+        return;
+    }
+    registered->event       = *event;
+    processing_repeat_count = *registered_count;
+    process_record(registered);
+    processing_repeat_count = 0;
+    if (!event->pressed && !alternate) {
+        unregister_weak_mods(last_mods);
+    }
+}
+
+static bool process_repeat_key(uint16_t keycode, keyrecord_t *record) {
+    static keyrecord_t repeat_record, alt_repeat_record;
+    static int8_t      repeat_count, alt_repeat_count;
+    if (keycode == QK_REP) {
+        repeat_key_invoke(&repeat_record, &repeat_count, &record->event, false);
+        return false;
+    }
+    if (keycode == QK_AREP) {
+        repeat_key_invoke(&alt_repeat_record, &alt_repeat_count, &record->event, true);
+        return false;
+    }
+    return true;
+}
+#endif
+
+// Caps Word, without the idle timeout (the Cantor disables it).
+
+#ifdef CAPS_WORD_ENABLE
+static bool caps_word_active = false;
+
+__attribute__((weak)) void caps_word_set_user(bool active) {}
+
+__attribute__((weak)) bool caps_word_press_user(uint16_t keycode) {
+    switch (keycode) {
+        case KC_A ... KC_Z:
+        case KC_MINS:
+            add_weak_mods(MOD_BIT(KC_LSFT));
+            return true;
+        case KC_1 ... KC_0:
+        case KC_BSPC:
+        case KC_DEL:
+        case KC_UNDS:
+            return true;
+    }
+    return false;
+}
+
+bool is_caps_word_on(void) {
+    return caps_word_active;
+}
+
+void caps_word_on(void) {
+    if (caps_word_active) {
+        return;
+    }
+    clear_mods();
+    clear_oneshot_mods();
+    caps_word_active = true;
+    caps_word_set_user(true);
+}
+
+void caps_word_off(void) {
+    if (!caps_word_active) {
+        return;
+    }
+    unregister_weak_mods(MOD_MASK_SHIFT);
+    caps_word_active = false;
+    caps_word_set_user(false);
+}
+
+void caps_word_toggle(void) {
+    caps_word_active ? caps_word_off() : caps_word_on();
+}
+
+static bool process_caps_word(uint16_t keycode, keyrecord_t *record) {
+    if (!caps_word_active || !record->event.pressed) {
+        return true;
+    }
+    if (((get_mods() | get_oneshot_mods()) & ~(MOD_MASK_SHIFT | MOD_BIT_RALT)) == 0) {
+        if (IS_QK_MOD_TAP(keycode)) {
+            if (record->tap.count == 0) {
+                switch (QK_MOD_TAP_GET_MODS(keycode)) {
+                    case MOD_LSFT:
+                        keycode = KC_LSFT;
+                        break;
+                    case MOD_RSFT:
+                        keycode = KC_RSFT;
+                        break;
+                    case MOD_RALT:
+                        return true;
+                    default:
+                        caps_word_off();
+                        return true;
+                }
+            } else {
+                keycode = QK_MOD_TAP_GET_TAP_KEYCODE(keycode);
+            }
+        } else if (IS_QK_LAYER_TAP(keycode)) {
+            if (record->tap.count == 0) {
+                return true;
+            }
+            keycode = QK_LAYER_TAP_GET_TAP_KEYCODE(keycode);
+        } else if (IS_QK_TAP_DANCE(keycode) || keycode == KC_RALT || keycode == QK_REP || keycode == QK_AREP) {
+            // The dance decides for itself; repeated keys are checked as they
+            // come through again.
+            return true;
+        }
+        clear_weak_mods();
+        if (caps_word_press_user(keycode)) {
+            send_keyboard_report();
+            return true;
+        }
+    }
+    caps_word_off();
+    return true;
+}
+#endif
+
+// Key overrides. One at a time, active from the trigger's press with its mods
+// down to the trigger's release; the trigger mods are kept out of the report
+// meanwhile.
+
+#ifdef KEY_OVERRIDE_ENABLE
+static const key_override_t *active_override = NULL;
+static keypos_t              active_override_key;
+
+// Left and right count the same.
+static uint8_t mods_either_side(uint8_t mods) {
+    return (mods | mods >> 4) & 0x0F;
+}
+
+static void key_override_deactivate(void) {
+    const key_override_t *override = active_override;
+    active_override                = NULL;
+    suppressed_mods                = 0;
+    unregister_code16(override->replacement);
+    send_keyboard_report();
+}
+
+static bool process_key_override(uint16_t keycode, keyrecord_t *record) {
+    if (!record->event.pressed) {
+        if (active_override && keypos_equal(record->event.key, active_override_key)) {
+            key_override_deactivate();
+            return false;
+        }
+        return true;
+    }
+    if (record->tap.count) {
+        keycode = get_tap_keycode(keycode);
+    }
+    uint8_t mods = mods_either_side(get_mods() | get_oneshot_mods());
+    for (uint8_t i = 0; i < key_override_count(); i++) {
+        const key_override_t *override = key_override_get(i);
+        uint8_t               trigger  = mods_either_side(override->trigger_mods);
+        if (keycode != override->trigger || (mods & trigger) != trigger || (mods & mods_either_side(override->negative_mod_mask)) || !(override->layers & ((layer_state_t)1 << get_highest_layer(layer_state | default_layer_state)))) {
+            continue;
+        }
+        if (active_override) {
+            key_override_deactivate();
+        }
+        active_override     = override;
+        active_override_key = record->event.key;
+        suppressed_mods     = override->suppressed_mods;
+        register_code16(override->replacement);
+        return false;
+    }
+    return true;
+}
+#endif
+
+// Tap dance, one dance at a time.
+
+#ifdef TAP_DANCE_ENABLE
+static uint16_t          dance_keycode = KC_NO;
+static tap_dance_state_t dance_state;
+static uint16_t          dance_timer;
+
+static void dance_call(tap_dance_user_fn_t fn) {
+    if (fn) {
+        fn(&dance_state, tap_dance_get(QK_TAP_DANCE_GET_INDEX(dance_keycode))->user_data);
+    }
+}
+
+static void dance_reset(void) {
+    dance_call(tap_dance_get(QK_TAP_DANCE_GET_INDEX(dance_keycode))->fn.on_reset);
+    dance_keycode = KC_NO;
+    memset(&dance_state, 0, sizeof(dance_state));
+}
+
+static void dance_finish(void) {
+    if (dance_state.finished) {
+        return;
+    }
+    dance_state.finished = true;
+    dance_call(tap_dance_get(QK_TAP_DANCE_GET_INDEX(dance_keycode))->fn.on_dance_finished);
+    if (!dance_state.pressed) {
+        dance_reset();
+    }
+}
+
+// Runs ahead of everything else: pressing another key ends the dance first.
+static void preprocess_tap_dance(uint16_t keycode, keyrecord_t *record) {
+    if (dance_keycode == KC_NO || !record->event.pressed || keycode == dance_keycode) {
+        return;
+    }
+    dance_state.interrupted          = true;
+    dance_state.interrupting_keycode = keycode;
+    dance_finish();
+}
+
+static bool process_tap_dance(uint16_t keycode, keyrecord_t *record) {
+    if (!IS_QK_TAP_DANCE(keycode)) {
+        return true;
+    }
+    if (QK_TAP_DANCE_GET_INDEX(keycode) >= tap_dance_count()) {
+        return false;
+    }
+    if (record->event.pressed) {
+        if (dance_keycode != keycode) {
+            dance_keycode = keycode;
+            memset(&dance_state, 0, sizeof(dance_state));
+        }
+        dance_state.count++;
+        dance_state.pressed      = true;
+        dance_state.weak_mods    = get_weak_mods();
+        dance_state.oneshot_mods = get_oneshot_mods();
+        dance_timer              = timer_read();
+        dance_call(tap_dance_get(QK_TAP_DANCE_GET_INDEX(keycode))->fn.on_each_tap);
+    } else if (dance_keycode == keycode) {
+        dance_state.pressed = false;
+        dance_call(tap_dance_get(QK_TAP_DANCE_GET_INDEX(keycode))->fn.on_each_release);
+        if (dance_state.finished) {
+            dance_reset();
+        }
+    }
+    return false;
+}
+
+static void tap_dance_task(void) {
+    if (dance_keycode == KC_NO || dance_state.finished) {
+        return;
+    }
+    keyrecord_t record = {.event.pressed = dance_state.pressed, .keycode = dance_keycode};
+    if (timer_elapsed(dance_timer) > tapping_term(dance_keycode, &record)) {
+        dance_finish();
+    }
+}
+#endif
+
+// Leader key
+
+#ifdef LEADER_ENABLE
+#    define LEADER_SEQUENCE_SIZE 5
+
+static bool     leading = false;
+static uint16_t leader_time;
+static uint16_t leader_sequence[LEADER_SEQUENCE_SIZE];
+static uint8_t  leader_sequence_size = 0;
+
+__attribute__((weak)) void leader_start_user(void) {}
+
+__attribute__((weak)) void leader_end_user(void) {}
+
+static void leader_start(void) {
+    if (leading) {
+        return;
+    }
+    leading              = true;
+    leader_time          = timer_read();
+    leader_sequence_size = 0;
+    memset(leader_sequence, 0, sizeof(leader_sequence));
+    leader_start_user();
+}
+
+static void leader_end(void) {
+    leading = false;
+    leader_end_user();
+}
+
+bool leader_sequence_active(void) {
+    return leading;
+}
+
+bool leader_sequence_timed_out(void) {
+#    ifdef LEADER_NO_TIMEOUT
+    return leader_sequence_size > 0 && timer_elapsed(leader_time) > LEADER_TIMEOUT;
+#    else
+    return timer_elapsed(leader_time) > LEADER_TIMEOUT;
+#    endif
+}
+
+static bool leader_sequence_is(uint16_t kc1, uint16_t kc2, uint16_t kc3, uint16_t kc4, uint16_t kc5) {
+    return leader_sequence[0] == kc1 && leader_sequence[1] == kc2 && leader_sequence[2] == kc3 && leader_sequence[3] == kc4 && leader_sequence[4] == kc5;
+}
+
+bool leader_sequence_one_key(uint16_t kc) {
+    return leader_sequence_is(kc, 0, 0, 0, 0);
+}
+
+bool leader_sequence_two_keys(uint16_t kc1, uint16_t kc2) {
+    return leader_sequence_is(kc1, kc2, 0, 0, 0);
+}
+
+bool leader_sequence_three_keys(uint16_t kc1, uint16_t kc2, uint16_t kc3) {
+    return leader_sequence_is(kc1, kc2, kc3, 0, 0);
+}
+
+static bool process_leader(uint16_t keycode, keyrecord_t *record) {
+    if (!record->event.pressed) {
+        return true;
+    }
+    if (leading && !leader_sequence_timed_out()) {
+        if (IS_QK_MOD_TAP(keycode) || IS_QK_LAYER_TAP(keycode)) {
+            keycode = get_tap_keycode(keycode);
+        }
+        leader_sequence[leader_sequence_size++] = keycode;
+        if (leader_sequence_size == LEADER_SEQUENCE_SIZE) {
+            leader_end();
+        }
+#    ifdef LEADER_PER_KEY_TIMING
+        leader_time = timer_read();
+#    endif
+        return false;
+    }
+    if (keycode == QK_LEAD) {
+        leader_start();
+    }
+    return true;
+}
+
+static void leader_task(void) {
+    if (leading && leader_sequence_timed_out()) {
+        leader_end();
+    }
+}
+#endif
+
+// Actions
+
+// ACT_LAYER_TAP and ACT_LAYER_TAP_EXT with OP_ON_OFF or OP_OFF_ON; the only
+// actions the keymaps build by hand.
+void process_action(keyrecord_t *record, action_t action) {
+    uint8_t kind = action.code >> 12;
+    if (kind != 0xA && kind != 0xB) {
+        return;
+    }
+    uint8_t layer = ((action.code >> 8) & 0x0F) + (kind == 0xB ? 16 : 0);
+    switch (action.code & 0xFF) {
+        case 0xF1:
+            record->event.pressed ? layer_on(layer) : layer_off(layer);
+            break;
+        case 0xF2:
+            record->event.pressed ? layer_off(layer) : layer_on(layer);
+            break;
+    }
+}
+
+static void process_keycode(uint16_t keycode, keyrecord_t *record) {
+    bool pressed = record->event.pressed;
+    if (IS_QK_MOD_TAP(keycode) || IS_QK_LAYER_TAP(keycode)) {
+        if (record->tap.count) {
+            pressed ? register_code(get_tap_keycode(keycode)) : unregister_code(get_tap_keycode(keycode));
+        } else if (IS_QK_MOD_TAP(keycode)) {
+            uint8_t mods = mod_config_8bit(QK_MOD_TAP_GET_MODS(keycode));
+            pressed ? register_mods(mods) : unregister_mods(mods);
+        } else {
+            pressed ? layer_on(QK_LAYER_TAP_GET_LAYER(keycode)) : layer_off(QK_LAYER_TAP_GET_LAYER(keycode));
+        }
+    } else if (keycode <= QK_MODS_MAX) {
+        pressed ? register_code16(keycode) : unregister_code16(keycode);
+    }
+}
+
+// In the order of QMK's process_record_quantum.
+static void process_record(keyrecord_t *record) {
+    uint16_t keycode = record->keycode;
+#ifdef TAP_DANCE_ENABLE
+    preprocess_tap_dance(keycode, record);
+#endif
+    if (
+#ifdef REPEAT_KEY_ENABLE
+        process_last_key(keycode, record) && process_repeat_key(keycode, record) &&
+#endif
+#ifdef CAPS_WORD_ENABLE
+        process_caps_word(keycode, record) &&
+#endif
+        process_record_user(keycode, record) &&
+#ifdef KEY_OVERRIDE_ENABLE
+        process_key_override(keycode, record) &&
+#endif
+#ifdef TAP_DANCE_ENABLE
+        process_tap_dance(keycode, record) &&
+#endif
+#ifdef LEADER_ENABLE
+        process_leader(keycode, record) &&
+#endif
+        true) {
+        process_keycode(keycode, record);
+    }
+}
+
+// Tap-hold. The pending key and every event after it wait here until the key
+// resolves.
+
+#define WAITING_BUFFER_SIZE 8
+
+static uint16_t    source_keycodes[MATRIX_ROWS][MATRIX_COLS]; // keycode each held key was pressed as
+static keyrecord_t tapping_key;
+static bool        tapping_active = false;
+static keyevent_t  waiting_buffer[WAITING_BUFFER_SIZE];
+static uint8_t     waiting_count = 0;
+
+static void tapping_process(keyevent_t event);
+
+static bool is_tap_hold(uint16_t keycode) {
+    return IS_QK_MOD_TAP(keycode) || IS_QK_LAYER_TAP(keycode);
+}
+
+static void process_event(keyevent_t event) {
+    if (event.key.row >= MATRIX_ROWS || event.key.col >= MATRIX_COLS) {
+        return;
+    }
+    uint16_t *source  = &source_keycodes[event.key.row][event.key.col];
+    uint16_t  keycode = event.pressed ? keycode_at(event.key) : *source;
+    if (event.pressed) {
+        *source = keycode;
+    }
+    keyrecord_t record = {.event = event, .keycode = keycode};
+    if (event.pressed && is_tap_hold(keycode)) {
+        tapping_key    = record;
+        tapping_active = true;
+        return;
+    }
+    process_record(&record);
+}
+
+static void tapping_resolve(bool tap) {
+    keyrecord_t record = tapping_key;
+    tapping_active     = false;
+    record.tap.count   = tap ? 1 : 0;
+    process_record(&record);
+
+    keyevent_t waiting[WAITING_BUFFER_SIZE];
+    uint8_t    count = waiting_count;
+    memcpy(waiting, waiting_buffer, sizeof(waiting));
+    waiting_count = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        tapping_process(waiting[i]);
+    }
+
+    if (tap) {
+        record.event.pressed = false;
+        record.event.time    = timer_read() | 1;
+        process_record(&record);
+    }
+}
+
+static void tapping_process(keyevent_t event) {
+    if (!tapping_active) {
+        process_event(event);
+        return;
+    }
+    if (!event.pressed && keypos_equal(event.key, tapping_key.event.key)) {
+        tapping_resolve(true);
+        return;
+    }
+    if (!event.pressed) {
+        for (uint8_t i = 0; i < waiting_count; i++) {
+            if (waiting_buffer[i].pressed && keypos_equal(waiting_buffer[i].key, event.key)) {
+                // Another key tapped while the tap-hold key is down.
+                tapping_resolve(false);
+                tapping_process(event);
+                return;
+            }
+        }
+    }
+    if (waiting_count == WAITING_BUFFER_SIZE) {
+        tapping_resolve(false);
+        tapping_process(event);
+        return;
+    }
+    waiting_buffer[waiting_count++] = event;
+}
+
+// pre_process_record_user runs first, before tap-hold buffering, as QMK runs
+// pre_process_record_quantum. As in QMK, a press first clears the weak mods
+// left by earlier keys, even one that is then held back.
+void action_exec(keyevent_t event) {
+    keyrecord_t record = {.event = event};
+    if (event.pressed) {
+        clear_weak_mods();
+    }
+    if (pre_process_record_user(keycode_at(event.key), &record)) {
+        tapping_process(event);
+    }
+}
+
+static void tapping_task(void) {
+    // Event times are odd, as for a tick event in QMK.
+    if (tapping_active && (uint16_t)((timer_read() | 1) - tapping_key.event.time) >= tapping_term(tapping_key.keycode, &tapping_key)) {
+        tapping_resolve(false);
+    }
+}
+
+// Matrix and main loop
+
+static matrix_row_t matrix[MATRIX_ROWS];
+static matrix_row_t matrix_previous[MATRIX_ROWS];
+
+matrix_row_t matrix_get_row(uint8_t row) {
+    return matrix_previous[row];
+}
+
+SIM_EXPORT void sim_matrix_set(uint8_t row, uint8_t col, bool pressed) {
+    if (row < MATRIX_ROWS && col < MATRIX_COLS) {
+        matrix_row_t bit = (matrix_row_t)1 << col;
+        matrix[row]      = pressed ? matrix[row] | bit : matrix[row] & ~bit;
+    }
+}
+
+SIM_EXPORT void sim_scan(void) {
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        matrix_row_t changed = matrix[row] ^ matrix_previous[row];
+        for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+            matrix_row_t bit = (matrix_row_t)1 << col;
+            if (changed & bit) {
+                matrix_previous[row] ^= bit;
+                action_exec(MAKE_KEYEVENT(row, col, matrix[row] & bit));
+            }
+        }
+    }
+    tapping_task();
+#ifdef TAP_DANCE_ENABLE
+    tap_dance_task();
+#endif
+#ifdef LEADER_ENABLE
+    leader_task();
+#endif
+    housekeeping_task_user();
+}
+
+SIM_EXPORT void sim_init(const sim_host_t *sim_host, uint32_t time_us) {
+    host   = *sim_host;
+    now_us = time_us;
+    keyboard_post_init_user();
+}
+
+// EEPROM
+
+#ifdef EECONFIG_USER_DATA_SIZE
+static uint8_t user_datablock[EECONFIG_USER_DATA_SIZE];
+
+void eeconfig_read_user_datablock(void *data, uint32_t offset, uint32_t length) {
+    if (offset + length <= EECONFIG_USER_DATA_SIZE) {
+        memcpy(data, &user_datablock[offset], length);
+    }
+}
+
+void eeconfig_update_user_datablock(const void *data, uint32_t offset, uint32_t length) {
+    if (offset + length <= EECONFIG_USER_DATA_SIZE) {
+        memcpy(&user_datablock[offset], data, length);
+    }
+}
+#endif
+
+// Raw HID
+
+void raw_hid_send(uint8_t *data, uint8_t length) {
+    last_in_us = now_us;
+    in_sent    = true;
+    if (host.raw_hid_send) {
+        host.raw_hid_send(host.context, data, length);
+    }
+}
+
+// The IN endpoint takes one report per polling interval.
+bool raw_hid_queue_endpoint_ready(void) {
+    return !in_sent || now_us - last_in_us >= host.usb_interval_us;
+}
+
+SIM_EXPORT void sim_raw_hid_receive(const uint8_t *data, uint8_t length) {
+    uint8_t report[RAW_EPSIZE] = {0};
+    memcpy(report, data, length < RAW_EPSIZE ? length : RAW_EPSIZE);
+    raw_hid_receive(report, RAW_EPSIZE);
+}
@@ -0,0 +1,51 @@
+// Interface of a keymap built for the host. Each keymap is linked with sim.c
+// and the userspace modules into a shared object exporting these functions;
+// harnesses dlopen one object per simulated device, so each device keeps its
+// own copy of every global.
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SIM_EXPORT __attribute__((visibility("default")))
+
+typedef struct {
+    void *context;
+    // Raw HID IN report, as the relay would read it.
+    void (*raw_hid_send)(void *context, const uint8_t *data, uint8_t length);
+    // Reports as the OS sees them, after the keymap's driver hooks.
+    void (*keyboard_report)(void *context, uint8_t mods, const uint8_t *keys);
+    void (*extra_report)(void *context, uint8_t report_id, uint16_t usage);
+    // Minimum spacing of raw HID IN reports (the endpoint's polling interval),
+    // zero for none.
+    uint32_t usb_interval_us;
+} sim_host_t;
+
+// Call once after loading. There is no reset; load the object again instead.
+SIM_EXPORT void sim_init(const sim_host_t *host, uint32_t now_us);
+// Time only moves forward; wait_ms inside the keymap advances it too.
+SIM_EXPORT void     sim_set_time(uint32_t now_us);
+SIM_EXPORT uint32_t sim_time(void);
+// Sets a switch, seen by the next scan.
+SIM_EXPORT void sim_matrix_set(uint8_t row, uint8_t col, bool pressed);
+// One pass of the main loop: matrix changes, tap-hold timeouts, housekeeping.
+SIM_EXPORT void sim_scan(void);
+// Raw HID OUT report from the host.
+SIM_EXPORT void     sim_raw_hid_receive(const uint8_t *data, uint8_t length);
+SIM_EXPORT uint32_t sim_layer_state(void);
+
+// Harness side: a loaded keymap object.
+typedef struct {
+    void *handle;
+    void (*init)(const sim_host_t *host, uint32_t now_us);
+    void (*set_time)(uint32_t now_us);
+    uint32_t (*time)(void);
+    void (*matrix_set)(uint8_t row, uint8_t col, bool pressed);
+    void (*scan)(void);
+    void (*raw_hid_receive)(const uint8_t *data, uint8_t length);
+    uint32_t (*layer_state)(void);
+} sim_device_t;
+
+bool  sim_load(sim_device_t *device, const char *path);
+void  sim_unload(sim_device_t *device);
+void *sim_symbol(sim_device_t *device, const char *name);
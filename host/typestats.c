@@ -0,0 +1,244 @@
+// Reads the typing statistics of windexlight devices built with
+// TYPING_STATS_ENABLE over raw HID.
+//
+//     typestats [-r] [-w seconds] [-n bigrams] [/dev/hidrawN ...]
+//
+// Prints the most common bigrams, as estimated from the count-min sketch, the
+// same-finger bigrams by matrix position and the hits of each magic.rules line.
+// -r resets the stats after reading; -w resets, waits the given time and then
+// reads. Without device paths every raw HID device is read.
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hidraw.h"
+#include "raw_hid_commands.h"
+#include "typing_stats.h"
+
+#define MAX_DEVICES 8
+#define REPLY_TIMEOUT_MS 500
+#define FRAMES_PER_REQUEST 8
+
+// Keys bigrams are counted over, with the names magic.rules would use.
+#define FIRST_KEY 0x04 // KC_A
+#define LAST_KEY 0x38  // KC_SLSH
+
+typedef struct {
+    uint16_t bigram;
+    uint16_t count;
+} bigram_t;
+
+static const char *paths[MAX_DEVICES];
+static int         path_count = 0;
+
+static void device_found(const char *path) {
+    if (path_count < MAX_DEVICES) {
+        paths[path_count++] = strdup(path);
+    }
+}
+
+static const char *key_name(uint8_t key) {
+    static const char *names[] = {
+        [0x28] = "ent", [0x29] = "esc", [0x2A] = "bspc", [0x2B] = "tab", [0x2C] = "spc", [0x2D] = "-",  [0x2E] = "=",  [0x2F] = "[",
+        [0x30] = "]",   [0x31] = "\\",  [0x33] = ";",    [0x34] = "'",   [0x35] = "`",   [0x36] = ",",  [0x37] = ".",  [0x38] = "/",
+    };
+    static char name[2];
+    if (key == TYPING_STATS_KEY_REPEAT) {
+        return "@";
+    } else if (key == TYPING_STATS_KEY_MAGIC) {
+        return "*";
+    } else if (key >= 0x04 && key <= 0x1D) {
+        name[0] = 'a' + key - 0x04;
+    } else if (key >= 0x1E && key <= 0x27) {
+        name[0] = '0' + (key - 0x1D) % 10;
+    } else if (key < sizeof(names) / sizeof(names[0]) && names[key]) {
+        return names[key];
+    } else {
+        return "?";
+    }
+    name[1] = 0;
+    return name;
+}
+
+// Reads frames of the block from offset until size, into block. Returns false
+// on a missing or out of order frame.
+static bool block_read(int fd, uint8_t *block, uint16_t offset, uint16_t size) {
+    while (offset < size) {
+        uint8_t request[REPORT_SIZE] = {RAW_HID_CMD_TYPING_STATS, 0, offset & 0xFF, offset >> 8, FRAMES_PER_REQUEST};
+        if (!hidraw_write(fd, request)) {
+            return false;
+        }
+        for (int i = 0; i < FRAMES_PER_REQUEST && offset < size; i++) {
+            uint8_t report[REPORT_SIZE];
+            if (!hidraw_read_reply(fd, RAW_HID_CMD_TYPING_STATS, report, REPLY_TIMEOUT_MS) || (report[1] | report[2] << 8) != offset) {
+                return false;
+            }
+            uint8_t length = report[3];
+            if (length > REPORT_SIZE - TYPING_STATS_FRAME_HEADER || offset + length > size) {
+                return false;
+            }
+            memcpy(&block[offset], &report[TYPING_STATS_FRAME_HEADER], length);
+            offset += length;
+        }
+    }
+    return true;
+}
+
+// The whole block, malloc'd, or NULL.
+static uint8_t *stats_read(int fd) {
+    typing_stats_header_t header;
+    if (!block_read(fd, (uint8_t *)&header, 0, sizeof(header))) {
+        return NULL;
+    }
+    uint8_t *block = malloc(header.size > sizeof(header) ? header.size : sizeof(header));
+    memcpy(block, &header, sizeof(header));
+    if (!block_read(fd, block, sizeof(header), header.size)) {
+        free(block);
+        return NULL;
+    }
+    return block;
+}
+
+static bool stats_reset(int fd) {
+    uint8_t request[REPORT_SIZE] = {RAW_HID_CMD_TYPING_STATS, 1, 0, 0, 0};
+    return hidraw_write(fd, request);
+}
+
+static int bigram_compare(const void *a, const void *b) {
+    return (int)((const bigram_t *)b)->count - (int)((const bigram_t *)a)->count;
+}
+
+static void stats_print(const char *path, const uint8_t *block, int top) {
+    const typing_stats_header_t *header  = (const typing_stats_header_t *)block;
+    uint16_t                     width   = 1 << header->sketch_bits;
+    uint16_t                     keys    = header->matrix_rows * header->matrix_cols;
+    const uint16_t              *sketch  = (const uint16_t *)(block + sizeof(*header));
+    const uint16_t              *presses = sketch + header->sketch_depth * width;
+    const uint16_t              *same    = presses + keys;
+    const uint16_t              *lines   = same + keys;
+    const uint16_t              *hits    = lines + header->magic_rules;
+
+    printf("%s: %u.%03u s, %u bigrams, %u magic, %u repeat\n", path, header->elapsed_ms / 1000, header->elapsed_ms % 1000, header->bigrams, header->magic, header->repeat);
+
+    // Every bigram of the keys the firmware counts, estimated from the sketch.
+    uint8_t tokens[LAST_KEY - FIRST_KEY + 3];
+    int     token_count = 0;
+    for (int key = FIRST_KEY; key <= LAST_KEY; key++) {
+        tokens[token_count++] = key;
+    }
+    tokens[token_count++] = TYPING_STATS_KEY_REPEAT;
+    tokens[token_count++] = TYPING_STATS_KEY_MAGIC;
+    bigram_t *bigrams = malloc(token_count * token_count * sizeof(*bigrams));
+    int       count   = 0;
+    for (int i = 0; i < token_count; i++) {
+        for (int j = 0; j < token_count; j++) {
+            uint16_t bigram   = tokens[i] << 8 | tokens[j];
+            uint16_t estimate = UINT16_MAX;
+            for (int row = 0; row < header->sketch_depth; row++) {
+                uint16_t counter = sketch[row * width + typing_stats_column(row, bigram, header->sketch_bits)];
+                if (counter < estimate) {
+                    estimate = counter;
+                }
+            }
+            if (estimate > 0) {
+                bigrams[count++] = (bigram_t){bigram, estimate};
+            }
+        }
+    }
+    qsort(bigrams, count, sizeof(*bigrams), bigram_compare);
+    printf("  bigrams, at most:\n");
+    for (int i = 0; i < count && i < top; i++) {
+        printf("    %-5s", key_name(bigrams[i].bigram >> 8));
+        printf(" %-5s %6u\n", key_name(bigrams[i].bigram & 0xFF), bigrams[i].count);
+    }
+    free(bigrams);
+
+    printf("  same-finger bigrams / presses, by matrix position of the second key:\n");
+    for (int row = 0; row < header->matrix_rows; row++) {
+        printf("    %d:", row);
+        for (int col = 0; col < header->matrix_cols; col++) {
+            int key = row * header->matrix_cols + col;
+            printf(" %5u/%-5u", same[key], presses[key]);
+        }
+        printf("\n");
+    }
+
+    printf("  magic.rules hits:\n");
+    for (int rule = 0; rule < header->magic_rules; rule++) {
+        if (hits[rule]) {
+            printf("    line %-4u %6u\n", lines[rule], hits[rule]);
+        }
+    }
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-r] [-w seconds] [-n bigrams] [/dev/hidrawN ...]\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    bool     reset  = false;
+    uint32_t wait_s = 0;
+    int      top    = 40;
+    int      opt;
+    while ((opt = getopt(argc, argv, "rw:n:")) != -1) {
+        switch (opt) {
+            case 'r':
+                reset = true;
+                break;
+            case 'w':
+                wait_s = atoi(optarg);
+                break;
+            case 'n':
+                top = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    for (int i = optind; i < argc && path_count < MAX_DEVICES; i++) {
+        paths[path_count++] = argv[i];
+    }
+    if (path_count == 0) {
+        hidraw_scan(device_found);
+        if (path_count == 0) {
+            fprintf(stderr, "no raw HID devices found\n");
+            return 1;
+        }
+    }
+
+    int fds[MAX_DEVICES];
+    for (int i = 0; i < path_count; i++) {
+        fds[i] = open(paths[i], O_RDWR | O_CLOEXEC);
+        if (fds[i] < 0) {
+            perror(paths[i]);
+            return 1;
+        }
+    }
+    if (wait_s) {
+        for (int i = 0; i < path_count; i++) {
+            stats_reset(fds[i]);
+        }
+        sleep(wait_s);
+    }
+    int status = 0;
+    for (int i = 0; i < path_count; i++) {
+        uint8_t *block = stats_read(fds[i]);
+        if (!block) {
+            fprintf(stderr, "%s: no typing stats reply\n", paths[i]);
+            status = 1;
+            continue;
+        }
+        stats_print(paths[i], block, top);
+        free(block);
+        if (reset) {
+            stats_reset(fds[i]);
+        }
+    }
+    return status;
+}
@@ -16,3 +16,8 @@
 
 // TODO -- Add to this if there are other combos that cause bad side effects
 #define MODS_TO_NEUTRALIZE { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 }
+
+#define SHARED_KEYS_DEVICE_ID 1
+
+// Room for RUNTIME_RULES_MAX runtime rules, RUNTIME_RULES_EEPROM_SIZE bytes.
+#define EECONFIG_USER_DATA_SIZE 196
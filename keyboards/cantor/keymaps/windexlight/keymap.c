@@ -6,6 +6,16 @@
 #include "timer.h"
 #include "usb_descriptor.h"
 #include "host.h"
+#include "shared_keys.h"
+#include "raw_hid_commands.h"
+#include "raw_hid_queue.h"
+#include "matrix_stream.h"
+#include "key_trace.h"
+#include "latency_stats.h"
+#include "macro_player.h"
+#include "magic.h"
+#include "typing_stats.h"
+#include "runtime_rules.h"
 #include <assert.h>
 #include QMK_KEYBOARD_H
 
@@ -15,10 +25,7 @@ void send_extra_user(report_extra_t* report);
 uint8_t USAGE2KEYCODE(uint16_t usage);
 
 static void send_raw_hid_report(void);
-static void process_shared_keys_remote(uint32_t keys);
-static void shared_key_event_local(uint8_t key, bool pressed);
-static void shared_keys_send(void);
-static void shared_key_event(uint8_t key, bool pressed);
+static void host_failover(void);
 
 enum layers {
     _MAGIC_STURDY,
@@ -30,16 +37,7 @@ enum layers {
     _NUM_LAYER,
     _FUN_LAYER,
     _NUM_NVIM_LAYER,
-};
-
-enum shared_keys {
-    _SK_DRAG_SCROLL,
-    _SK_NUM,
-    _SK_FUN,
-    _SK_SYM,
-    _SK_NAV,
-    _SK_NVIM = 30,
-    _SK_NVIM_NORMAL,
+    LAYER_COUNT,
 };
 
 #define MAGIC QK_AREP
@@ -77,41 +75,15 @@ enum shared_keys {
 #define _NUM(x) LT(_NUM_LAYER, x)
 #define _FUN(x) LT(_FUN_LAYER, x)
 
-#define HEARTBEAT_TIMEOUT_MS 2000
-
 enum custom_keycodes {
     TSL_NUM = SAFE_RANGE,
-    // https://github.com/getreuer/qmk-keymap/blob/main/getreuer.c
-    // Macros invoked through the Magic key.
     OSL_NUM,
-    UPDIR,
-    M_N,
-    M_DOCSTR,
-    M_EQEQ,
-    M_INCLUDE,
-    M_ION,
-    M_MENT,
-    M_MKGRVS,
-    M_QUEN,
-    M_THE,
-    M_CAP_THE,
-    M_TMENT,
-    M_UPDIR,
-    M_NBSP,
-    M_BEFORE,
-    M_JUST,
-    M_NION,
-    M_VER,
-    M_WHICH,
-    M_XES,
-    M_BUT,
-    M_LL,
-    M_VE,
-    M_NOOP,
     _SK_START,
-    _SK_END = _SK_START + 32,
+    _SK_END = _SK_START + SHARED_KEYS_COUNT,
 };
 
+static_assert(_SK_END <= MAGIC_KEYCODE_START, "custom keycodes run into the magic strings");
+
 #define _SK(x) (_SK_START + (x))
 #define SK_DS _SK(_SK_DRAG_SCROLL)
 
@@ -124,15 +96,11 @@ typedef struct {
 static key_needing_release_t keys_needing_release[MAX_KEYS_NEEDING_RELEASE];
 static uint8_t keys_needing_release_count = 0;
 static uint8_t tsl_count = 0;
-static uint32_t last_heartbeat_time = 0;
-static uint8_t raw_hid_report[RAW_EPSIZE];
 static bool suppress_real_reports = false;
 static bool send_raw_hid_reports = false;
 static bool nvim_active = false;
 
 // static bool host_connection = false;
-static uint32_t shared_keys_local = 0;
-static uint32_t shared_keys_remote = 0;
 
 static report_nkro_t nkro_report_user = {
     .report_id = REPORT_ID_NKRO,
@@ -140,67 +108,100 @@ static report_nkro_t nkro_report_user = {
     .bits = {0},
 };
 
+// The extra keycodes KC_SYSTEM_POWER..KC_LAUNCHPAD sit inside this window of the
+// NKRO bitmap, kept as whole words so a report can be applied with a few masks.
+#define MIRROR_EXTRA_BASE 0xA0
+#define MIRROR_EXTRA_WORDS 2
+static_assert(KC_SYSTEM_POWER >= MIRROR_EXTRA_BASE && KC_LAUNCHPAD < MIRROR_EXTRA_BASE + 32 * MIRROR_EXTRA_WORDS, "extra keycodes outside the mirror window");
+static_assert((MIRROR_EXTRA_BASE + 32 * MIRROR_EXTRA_WORDS) / 8 <= NKRO_REPORT_BITS, "mirror window outside the NKRO bitmap");
+
+// Mask of keycodes lo..hi within word w of the window.
+#define MIRROR_BITS_FROM(n) ((n) <= 0 ? 0xFFFFFFFFu : (n) >= 32 ? 0u : 0xFFFFFFFFu << ((n) & 31))
+#define MIRROR_EXTRA_MASK(lo, hi, w) (MIRROR_BITS_FROM((lo) - MIRROR_EXTRA_BASE - 32 * (w)) & ~MIRROR_BITS_FROM((hi) + 1 - MIRROR_EXTRA_BASE - 32 * (w)))
+
+static const uint32_t mirror_system_mask[MIRROR_EXTRA_WORDS] = {
+    MIRROR_EXTRA_MASK(KC_SYSTEM_POWER, KC_SYSTEM_WAKE, 0),
+    MIRROR_EXTRA_MASK(KC_SYSTEM_POWER, KC_SYSTEM_WAKE, 1),
+};
+static const uint32_t mirror_consumer_mask[MIRROR_EXTRA_WORDS] = {
+    MIRROR_EXTRA_MASK(KC_AUDIO_MUTE, KC_LAUNCHPAD, 0),
+    MIRROR_EXTRA_MASK(KC_AUDIO_MUTE, KC_LAUNCHPAD, 1),
+};
+
+enum mirror_formats {
+    MIRROR_FORMAT_NKRO,     // report_nkro_t as sent to the OS
+    MIRROR_FORMAT_EXTENDED, // mirror_frame_t
+};
+
+#define MIRROR_FLAG_MORE 0x01 // the key list continues in the next frame, same seq
+#define MIRROR_FLAG_CAPS_WORD 0x02
+#define MIRROR_FLAG_NVIM 0x04
+
+#define MIRROR_FRAME_KEYS 19
+
+// Extended mirror frame, giving the host the state it would otherwise have to
+// guess. seq counts mirror reports and is what the host acknowledges with 0xBD.
+typedef struct __attribute__((packed)) {
+    uint8_t  command;
+    uint8_t  flags;
+    uint16_t seq;
+    uint16_t timestamp;    // timer_read() when the report was mirrored
+    uint16_t layers;       // layer_state | default_layer_state
+    uint8_t  report_mods;  // mods in the HID report
+    uint8_t  mods;         // real mods
+    uint8_t  weak_mods;
+    uint8_t  oneshot_mods;
+    uint8_t  key_count;
+    uint8_t  keys[MIRROR_FRAME_KEYS]; // pressed keycodes, ascending
+} mirror_frame_t;
+
+static_assert(sizeof(mirror_frame_t) == RAW_EPSIZE, "mirror_frame_t does not match raw HID report size");
+static_assert(offsetof(mirror_frame_t, keys) == RAW_EPSIZE - MIRROR_FRAME_KEYS, "mirror_frame_t layout changed");
+static_assert(LAYER_COUNT <= 16, "mirror_frame_t.layers holds 16 layers");
+
+// Keyboard and extra (system/consumer) usages arrive in different reports, so
+// the mirror tracks them separately and only ORs them together when sending.
+static uint8_t mirror_keyboard_bits[NKRO_REPORT_BITS] = {0};
+static uint32_t mirror_extra_words[MIRROR_EXTRA_WORDS] = {0};
+static uint8_t mirror_keyboard_keys[KEYBOARD_REPORT_KEYS] = {0};
+
+// Reports withheld from the OS in host-processing mode, kept until the host
+// acknowledges the matching mirror frame so they can be replayed if it stalls.
+#define MAX_PENDING_REPORTS 8
+
+enum pending_report_type {
+    PENDING_KEYBOARD,
+    PENDING_NKRO,
+    PENDING_EXTRA,
+};
+
+typedef struct {
+    uint8_t type;
+    uint16_t time;
+    union {
+        report_keyboard_t keyboard;
+        report_nkro_t nkro;
+        report_extra_t extra;
+    };
+} pending_report_t;
+
+static pending_report_t pending_reports[MAX_PENDING_REPORTS];
+static uint8_t pending_reports_head = 0;
+static uint8_t pending_reports_count = 0;
+static uint16_t mirror_reports_sent = 0;
+static uint8_t mirror_format = 0;
+static uint8_t ack_timeout_ms = 0; // 0 = host doesn't acknowledge, rely on heartbeats only
+
 void (*send_keyboard_real)(report_keyboard_t *) = NULL;
 void (*send_nkro_real)(report_nkro_t *) = NULL;
 void (*send_extra_real)(report_extra_t *) = NULL;
 
-extern matrix_row_t matrix[MATRIX_ROWS];
-
 extern host_driver_t chibios_driver;
 
 
-// https://github.com/getreuer/qmk-keymap/blob/main/getreuer.c
-// An enhanced version of SEND_STRING: if Caps Word is active, the Shift key is
-// held while sending the string. Additionally, the last key is set such that if
-// the Repeat Key is pressed next, it produces `repeat_keycode`. This helper is
-// used for several macros below in my process_record_user() function.
-// windexlight modifications - clear non-shift mods. If shft_str is provided,
-// clear shift as well and send shft_str if shift was active, else send str.
-#define MAGIC_STRING(str, shft_str, repeat_keycode) \
-    magic_send_string_P(PSTR(str), PSTR(shft_str), (repeat_keycode))
-static void magic_send_string_P(const char* str, const char* shft_str, uint16_t repeat_keycode) {
-    uint8_t saved_mods = 0;
-    // If Caps Word is on, save the mods and hold Shift.
-    if (is_caps_word_on()) {
-        saved_mods = get_mods();
-        register_mods(MOD_BIT_LSHIFT);
-    }
-
-    uint8_t mods = get_mods();
-    uint8_t weak_mods = get_weak_mods();
-    uint8_t oneshot_mods = get_oneshot_mods();
-    if (shft_str != NULL) {
-        clear_mods();
-        clear_weak_mods();
-        clear_oneshot_mods();
-        if (((mods | weak_mods | oneshot_mods) & MOD_MASK_SHIFT) != 0) {
-            send_string_P(shft_str); // Send the shifted string.
-        } else {
-            send_string_P(str); // Send un-shifted string.
-        }
-    } else {
-        set_mods(mods & MOD_MASK_SHIFT);
-        set_weak_mods(weak_mods & MOD_MASK_SHIFT);
-        set_oneshot_mods(oneshot_mods & MOD_MASK_SHIFT);
-        send_string_P(str); // Send the string.
-    }
-    set_last_keycode(repeat_keycode);
-    set_last_mods(get_mods());
-    set_mods(mods);
-    set_weak_mods(weak_mods);
-    set_oneshot_mods(oneshot_mods);
-
-    // If Caps Word is on, restore the mods.
-    if (is_caps_word_on()) {
-        set_mods(saved_mods);
-    }
-}
-
 // Can somehow get stuck on a layer, like right symbol layer, for example... how?
-bool process_record_user(uint16_t keycode, keyrecord_t *record) {
-#ifdef CONSOLE_ENABLE
-    uprintf("KL: kc: 0x%04X, col: %2u, row: %2u, pressed: %u, time: %5u, int: %u, count: %u\n", keycode, record->event.key.col, record->event.key.row, record->event.pressed, record->event.time, record->tap.interrupted, record->tap.count);
-#endif
+// When it happens, host/keytrace shows the events that led up to it.
+static bool process_record_keymap(uint16_t keycode, keyrecord_t *record) {
     bool ret = true;
     if (keycode >= _SK_START && keycode < _SK_END) {
         shared_key_event_local(keycode - _SK_START, record->event.pressed);
@@ -235,28 +236,6 @@ bool process_record_user(uint16_t keycode, keyrecord_t *record) {
     //         }
     //     }
     // }
-    // https://github.com/getreuer/qmk-keymap/blob/main/getreuer.c
-    // If alt repeating key A, E, I, O, U, Y with no mods other than Shift, set
-    // the last key to KC_N. Above, alternate repeat of KC_N is defined to be
-    // again KC_N. This way, either tapping alt repeat and then repeat (or
-    // equivalently double tapping alt repeat) is useful to type certain patterns
-    // without SFBs:
-    //
-    //   D <altrep> <rep> -> DYN (as in "dynamic")
-    //   O <altrep> <rep> -> OAN (as in "loan")
-    int8_t rep_count = get_repeat_key_count();
-    if (rep_count < 0) {
-        if (((get_mods() | get_weak_mods() | get_oneshot_mods()) & ~MOD_MASK_SHIFT) == 0) {
-            if (keycode == KC_A || keycode == KC_E || keycode == KC_I ||
-                keycode == KC_O || keycode == KC_U || keycode == KC_Y) {
-                set_last_keycode(M_N);
-                set_last_mods(get_mods());
-            } else if (keycode == KC_QUOT) {
-                set_last_keycode(M_LL);
-                set_last_mods(get_mods());
-            }
-        }
-    }
     if (record->event.pressed) {
         if (tsl_count > 0) {
             if (--tsl_count == 0) {
@@ -268,39 +247,10 @@ bool process_record_user(uint16_t keycode, keyrecord_t *record) {
                 return false;
             }
         }
+        if (!magic_process_record(keycode, record)) {
+            return false;
+        }
         switch (keycode) {
-            // https://github.com/getreuer/qmk-keymap/blob/main/getreuer.c
-            // Macros invoked through the MAGIC key.
-            case M_THE:     MAGIC_STRING(/* */"the", "The", M_N); break;
-            case M_CAP_THE: MAGIC_STRING(/* */"The", "The", M_N); break;
-            case M_ION:     MAGIC_STRING(/*i*/"on", NULL, KC_S); break;
-            case M_MENT:    MAGIC_STRING(/*m*/"ent", NULL, KC_S); break;
-            case M_QUEN:    MAGIC_STRING(/*q*/"uen", NULL, KC_C); break;
-            case M_TMENT:   MAGIC_STRING(/*t*/"ment", NULL, KC_S); break;
-            case M_UPDIR:   MAGIC_STRING(/*.*/"./", NULL, UPDIR); break;
-            case M_INCLUDE: SEND_STRING_DELAY(/*#*/"include ", TAP_CODE_DELAY); break;
-            case M_EQEQ:    SEND_STRING_DELAY(/*=*/"==", TAP_CODE_DELAY); break;
-            case M_NBSP:    SEND_STRING_DELAY(/*&*/"nbsp;", TAP_CODE_DELAY); break;
-            case M_BEFORE:  MAGIC_STRING(/*b*/"efore", NULL, M_NOOP); break;
-            case M_JUST:    MAGIC_STRING(/*j*/"ust", NULL, M_NOOP); break;
-            case M_NION:    MAGIC_STRING(/*n*/"ion", NULL, KC_S); break;
-            case M_VER:     MAGIC_STRING(/*v*/"er", NULL, KC_S); break;
-            case M_WHICH:   MAGIC_STRING(/*w*/"hich", NULL, M_NOOP); break;
-            case M_XES:     MAGIC_STRING(/*x*/"es", NULL, M_NOOP); break;
-            case M_BUT:     MAGIC_STRING(/*,*/" but", NULL, M_NOOP); break;
-            case M_LL:      MAGIC_STRING(/*I'*/"ll", NULL, M_NOOP); break;
-            case M_VE:      MAGIC_STRING(/*I'*/"ve", NULL, M_NOOP); break;
-
-            case M_DOCSTR:
-                SEND_STRING_DELAY(/*"*/"\"\"\"\"\""
-                                  SS_TAP(X_LEFT) SS_TAP(X_LEFT) SS_TAP(X_LEFT), TAP_CODE_DELAY);
-                break;
-            case M_MKGRVS:
-                SEND_STRING_DELAY(/*`*/"``\n\n```" SS_TAP(X_UP), TAP_CODE_DELAY);
-                break;
-            case UPDIR:
-                SEND_STRING_DELAY("../", TAP_CODE_DELAY);
-                break;
             // case KC_SPC:
             //     // https://github.com/getreuer/qmk-keymap/blob/main/getreuer.c
             //     // When the Repeat key follows Space, it behaves as one-shot shift.
@@ -319,27 +269,6 @@ bool process_record_user(uint16_t keycode, keyrecord_t *record) {
             //     }
             //     break;
         }
-        // Repeat key overrides
-        if (rep_count > 0) {
-            ret = false;
-            switch (keycode) {
-                case M_N: MAGIC_STRING(/*n*/"n", /*n*/"n", M_NOOP); break;
-                default:
-                    switch (keycode & 0xFF) {
-                        case KC_A: MAGIC_STRING(/*a*/"nd", /*a*/"nd", M_NOOP); break;
-                        case KC_I: MAGIC_STRING(/*i*/"ng", /*i*/"ng", KC_S); break;
-                        case KC_Y: MAGIC_STRING(/*y*/"ou", /*y*/"ou", M_NOOP); break;
-                        case KC_N: MAGIC_STRING(/*n*/"f", /*n*/"f", M_NOOP); break;
-                        case KC_B: MAGIC_STRING(/*b*/"ecause", /*b*/"ecause", M_NOOP); break;
-                        case KC_W: MAGIC_STRING(/*w*/"ould", /*w*/"ould", M_NOOP); break;
-                        case KC_COMM: MAGIC_STRING(/*,*/" and", NULL, M_NOOP); break;
-                        case KC_SPC: MAGIC_STRING(/* */"for", "For", M_NOOP); break;
-                        case KC_QUOT: MAGIC_STRING(/*'*/"ll", NULL, M_NOOP); break;
-                        default: ret = true; break;
-                    }
-                    break;
-            }
-        }
         if (keycode == KC_DEL) {
             if (((get_mods() | get_weak_mods() | get_oneshot_mods()) & MOD_MASK_SHIFT) != 0) {
                 tap_code(KC_MINS);
@@ -363,6 +292,23 @@ bool process_record_user(uint16_t keycode, keyrecord_t *record) {
     return ret;
 }
 
+bool pre_process_record_user(uint16_t keycode, keyrecord_t *record) {
+    latency_stats_key_event(record, macro_player_replaying());
+    return macro_player_pre_process(record);
+}
+
+bool process_record_user(uint16_t keycode, keyrecord_t *record) {
+    uint32_t start = latency_stats_now();
+    key_trace_record(keycode, record);
+#ifdef TYPING_STATS_ENABLE
+    typing_stats_record(keycode, record);
+#endif
+    latency_stats_key_processed(record);
+    bool ret = process_record_keymap(keycode, record);
+    latency_stats_add(LATENCY_PROCESS_RECORD, latency_stats_now() - start);
+    return ret;
+}
+
 void keyboard_post_init_user(void) {
     // TODO - This is probably brittle to use chibios_driver, check here if breaks with future changes
     host_driver_t *driver = &chibios_driver; //host_get_driver(); <- can't use here, too early
@@ -372,160 +318,251 @@ void keyboard_post_init_user(void) {
     driver->send_keyboard = send_keyboard_user;
     driver->send_nkro = send_nkro_user;
     driver->send_extra = send_extra_user;
+#ifdef RUNTIME_RULES_ENABLE
+    runtime_rules_init();
+#endif
+}
+
+// Returns a slot to save a withheld report in, or NULL if the report is not
+// being withheld. Running out of slots means the host has fallen too far behind,
+// so fail over right away.
+static pending_report_t *pending_report_push(uint8_t type) {
+    if (!suppress_real_reports || ack_timeout_ms == 0) {
+        return NULL;
+    }
+    if (pending_reports_count == MAX_PENDING_REPORTS) {
+        host_failover();
+        return NULL;
+    }
+    pending_report_t *pending = &pending_reports[(pending_reports_head + pending_reports_count++) % MAX_PENDING_REPORTS];
+    pending->type = type;
+    pending->time = timer_read();
+    return pending;
+}
+
+// The host acknowledges with the number of mirror reports it has consumed so far,
+// modulo 2^16. Everything older than the still-outstanding reports is done.
+static void pending_reports_ack(uint16_t consumed) {
+    uint16_t outstanding = mirror_reports_sent - consumed;
+    while (pending_reports_count > outstanding) {
+        pending_reports_head = (pending_reports_head + 1) % MAX_PENDING_REPORTS;
+        pending_reports_count--;
+    }
+}
+
+// Leaves host-processing mode and replays whatever the host never acknowledged
+// straight to the OS, in order, so no keystrokes are lost.
+static void host_failover(void) {
+    send_raw_hid_reports = false;
+    suppress_real_reports = false;
+    for (; pending_reports_count > 0; pending_reports_count--) {
+        pending_report_t *pending = &pending_reports[pending_reports_head];
+        switch (pending->type) {
+            case PENDING_KEYBOARD:
+                (*send_keyboard_real)(&pending->keyboard);
+                break;
+            case PENDING_NKRO:
+                (*send_nkro_real)(&pending->nkro);
+                break;
+            case PENDING_EXTRA:
+                (*send_extra_real)(&pending->extra);
+                break;
+        }
+        pending_reports_head = (pending_reports_head + 1) % MAX_PENDING_REPORTS;
+    }
+}
+
+static void mirror_bit_set(uint8_t *bits, uint8_t code) {
+    if ((code >> 3) < NKRO_REPORT_BITS) {
+        bits[code >> 3] |= 1 << (code & 7);
+    }
+}
+
+static void mirror_bit_clear(uint8_t *bits, uint8_t code) {
+    if ((code >> 3) < NKRO_REPORT_BITS) {
+        bits[code >> 3] &= ~(1 << (code & 7));
+    }
+}
+
+static bool report_has_key(report_keyboard_t* report, uint8_t code) {
+    for (uint8_t i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+        if (report->keys[i] == code) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Applies only the slots that differ from the previous 6KRO report. QMK keeps
+// held keys in their slot, so usually this is one change per report.
+static void mirror_keyboard_report(report_keyboard_t* report) {
+    for (uint8_t i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+        uint8_t code = mirror_keyboard_keys[i];
+        if (code != report->keys[i] && code != 0 && !report_has_key(report, code)) {
+            mirror_bit_clear(mirror_keyboard_bits, code);
+        }
+    }
+    for (uint8_t i = 0; i < KEYBOARD_REPORT_KEYS; i++) {
+        uint8_t code = report->keys[i];
+        if (code != mirror_keyboard_keys[i] && code != 0) {
+            mirror_bit_set(mirror_keyboard_bits, code);
+        }
+        mirror_keyboard_keys[i] = code;
+    }
 }
 
 void send_keyboard_user(report_keyboard_t* report) {
+    latency_stats_report_sent();
+    pending_report_t *pending = pending_report_push(PENDING_KEYBOARD);
+    if (pending) {
+        pending->keyboard = *report;
+    }
     if (!suppress_real_reports) {
         (*send_keyboard_real)(report);
     }
     if (send_raw_hid_reports) {
         nkro_report_user.mods = report->mods;
-        memset(&nkro_report_user.bits, 0, sizeof(nkro_report_user.bits));
-        uint8_t code;
-        for (int i=0; i<KEYBOARD_REPORT_KEYS; i++) {
-            code = report->keys[i];
-            if (code != 0) {
-                if ((code >> 3) < NKRO_REPORT_BITS) {
-                    nkro_report_user.bits[code >> 3] |= 1 << (code & 7);
-                }
-            }
-        }
+        mirror_keyboard_report(report);
         send_raw_hid_report();
     }
 }
 
 void send_nkro_user(report_nkro_t* report) {
+    latency_stats_report_sent();
+    pending_report_t *pending = pending_report_push(PENDING_NKRO);
+    if (pending) {
+        pending->nkro = *report;
+    }
     if (!suppress_real_reports) {
         (*send_nkro_real)(report);
     }
     if (send_raw_hid_reports) {
-        memcpy(&nkro_report_user, report, sizeof(report_nkro_t));
+        nkro_report_user.mods = report->mods;
+        memcpy(mirror_keyboard_bits, report->bits, sizeof(mirror_keyboard_bits));
+        memset(mirror_keyboard_keys, 0, sizeof(mirror_keyboard_keys));
         send_raw_hid_report();
     }
 }
 
 void send_extra_user(report_extra_t* report) {
+    pending_report_t *pending = pending_report_push(PENDING_EXTRA);
+    if (pending) {
+        pending->extra = *report;
+    }
     if (!suppress_real_reports) {
         (*send_extra_real)(report);
     }
     if (send_raw_hid_reports) {
-        if (report->usage == 0) {
-            for (int code = KC_SYSTEM_POWER; code<=KC_SYSTEM_WAKE; code++) {
-                if ((code >> 3) < NKRO_REPORT_BITS) {
-                    nkro_report_user.bits[code >> 3] &= ~(1 << (code & 7));
-                }
-            }
-            for (int code = KC_AUDIO_MUTE; code<=KC_LAUNCHPAD; code++) {
-                if ((code >> 3) < NKRO_REPORT_BITS) {
-                    nkro_report_user.bits[code >> 3] &= ~(1 << (code & 7));
-                }
-            }
-        } else {
-            int code = USAGE2KEYCODE(report->usage);
-            if ((code >> 3) < NKRO_REPORT_BITS) {
-                nkro_report_user.bits[code >> 3] |= 1 << (code & 7);
-            }
+        // Each system or consumer report carries the whole state for its
+        // usage page, so drop that page's bits and set the new usage, if any.
+        const uint32_t *mask = report->report_id == REPORT_ID_SYSTEM ? mirror_system_mask : mirror_consumer_mask;
+        for (uint8_t w = 0; w < MIRROR_EXTRA_WORDS; w++) {
+            mirror_extra_words[w] &= ~mask[w];
         }
-        send_raw_hid_report();
-    }
-}
-
-static void send_raw_hid_report() {
-    static_assert(sizeof(report_nkro_t) == RAW_EPSIZE, "report_nkro_t does not match raw HID report size");
-    raw_hid_send((uint8_t*)&nkro_report_user, RAW_EPSIZE);
-
-    // static_assert(REPORT_ID_NKRO == 6, "REPORT_ID_NKRO unexpected value");
-    // static_assert(sizeof(matrix) <= RAW_EPSIZE-4, "Matrix too big for raw HID report size");
-    // static_assert(MATRIX_ROWS <= 0xFF, "Too many matrix rows for raw HID report");
-    // static_assert(MATRIX_COLS <= 0xFF, "Too many matrix cols for raw HID report");
-    // raw_hid_report[0] = 1; // non-standard report ID, we only need to stay away from REPORT_ID_NKRO
-    // raw_hid_report[1] = 0; //active_layer;
-    // raw_hid_report[2] = MATRIX_ROWS;
-    // raw_hid_report[3] = MATRIX_COLS;
-    // memcpy(raw_hid_report+4, matrix, sizeof(matrix));
-    // raw_hid_send(raw_hid_report, RAW_EPSIZE);
-}
-
-void raw_hid_receive(uint8_t *data, uint8_t length) {
-    if (length == 0) {
-        return;
-    }
-    if (data[0] == 0xBE) {
-        send_raw_hid_reports = true;
-        suppress_real_reports = true;
-    } else if (data[0] == 0xBF) {
-        send_raw_hid_reports = false;
-        suppress_real_reports = false;
-    } else if (data[0] == 0xC0) {
-        last_heartbeat_time = timer_read32();
-        // host_connection = true;
-        // shared_keys_send();
-    } else if (data[0] == 0xC1) {
-        if (length >= 5) {
-            process_shared_keys_remote(data[1] | (data[2] << 8) | (data[3] << 16) | (data[4] << 24));
+        uint8_t code = USAGE2KEYCODE(report->usage);
+        if (code != 0) {
+            code -= MIRROR_EXTRA_BASE;
+            mirror_extra_words[code / 32] |= (uint32_t)1 << (code % 32);
         }
+        send_raw_hid_report();
     }
 }
 
-void housekeeping_task_user() {
-    if (timer_elapsed32(last_heartbeat_time) > HEARTBEAT_TIMEOUT_MS) {
-        send_raw_hid_reports = false;
-        suppress_real_reports = false;
-        // host_connection = false;
-        process_shared_keys_remote(0);
-    }
-}
-
-static void process_shared_keys_remote(uint32_t keys) {
-    if (keys != shared_keys_remote) {
-        uint8_t i;
-        uint32_t b;
-        for (i = 0; i < 32; i++) {
-            b = 1 << i;
-            if (keys & b) {
-                if (!(shared_keys_remote & b)) {
-                    shared_key_event(i, true);
-                }
-            } else {
-                if (shared_keys_remote & b) {
-                    shared_key_event(i, false);
-                }
+// Lists the pressed keycodes from the composed NKRO bitmap, continuing into
+// further frames in the unlikely case more than MIRROR_FRAME_KEYS are down.
+static void send_mirror_frames(void) {
+    mirror_frame_t frame = {
+        .command = RAW_HID_CMD_MIRROR_EXTENDED,
+        .flags = (is_caps_word_on() ? MIRROR_FLAG_CAPS_WORD : 0) | (nvim_active ? MIRROR_FLAG_NVIM : 0),
+        .seq = mirror_reports_sent,
+        .timestamp = timer_read(),
+        .layers = layer_state | default_layer_state,
+        .report_mods = nkro_report_user.mods,
+        .mods = get_mods(),
+        .weak_mods = get_weak_mods(),
+        .oneshot_mods = get_oneshot_mods(),
+    };
+    for (uint8_t i = 0; i < NKRO_REPORT_BITS; i++) {
+        uint8_t bits = nkro_report_user.bits[i];
+        while (bits) {
+            if (frame.key_count == MIRROR_FRAME_KEYS) {
+                frame.flags |= MIRROR_FLAG_MORE;
+                raw_hid_queue_send((uint8_t*)&frame, RAW_EPSIZE);
+                frame.flags &= ~MIRROR_FLAG_MORE;
+                frame.key_count = 0;
+                memset(frame.keys, 0, sizeof(frame.keys));
             }
+            frame.keys[frame.key_count++] = i * 8 + __builtin_ctz(bits);
+            bits &= bits - 1;
         }
-        shared_keys_remote = keys;
     }
+    raw_hid_queue_send((uint8_t*)&frame, RAW_EPSIZE);
 }
 
-static void shared_key_event_local(uint8_t key, bool pressed) {
-    if (key >= 32) {
-        return;
+static void send_raw_hid_report() {
+    static_assert(sizeof(report_nkro_t) == RAW_EPSIZE, "report_nkro_t does not match raw HID report size");
+    memcpy(nkro_report_user.bits, mirror_keyboard_bits, sizeof(nkro_report_user.bits));
+    for (uint8_t i = 0; i < MIRROR_EXTRA_WORDS * 4; i++) {
+        nkro_report_user.bits[MIRROR_EXTRA_BASE / 8 + i] |= mirror_extra_words[i / 4] >> ((i % 4) * 8);
     }
-    uint32_t keys = shared_keys_local;
-    if (pressed) {
-        keys |= (1 << key);
+    if (mirror_format == MIRROR_FORMAT_EXTENDED) {
+        send_mirror_frames();
     } else {
-        keys &= ~(1 << key);
+        raw_hid_queue_send((uint8_t*)&nkro_report_user, RAW_EPSIZE);
     }
-    if (keys != shared_keys_local) {
-        if ((shared_keys_local | shared_keys_remote) != (keys | shared_keys_remote)) {
-            shared_key_event(key, pressed);
-        }
-        shared_keys_local = keys;
-        shared_keys_send();
+    mirror_reports_sent++;
+}
+
+// Optional arguments, zero (legacy padding) keeps the defaults:
+// [1..2] heartbeat timeout in ms, little-endian
+// [3]    ack timeout in ms, enables the per-report ack watchdog
+// [4]    mirror format, see mirror_formats
+static void host_mode_on(uint8_t *data, uint8_t length) {
+    shared_keys_set_heartbeat_timeout(length >= 3 ? data[1] | (data[2] << 8) : 0);
+    ack_timeout_ms = length >= 4 ? data[3] : 0;
+    mirror_format = length >= 5 ? data[4] : MIRROR_FORMAT_NKRO;
+    if (!send_raw_hid_reports) {
+        // The mirror is incremental and was not tracking while off.
+        memset(mirror_keyboard_bits, 0, sizeof(mirror_keyboard_bits));
+        memset(mirror_extra_words, 0, sizeof(mirror_extra_words));
+        memset(mirror_keyboard_keys, 0, sizeof(mirror_keyboard_keys));
+    }
+    if (!suppress_real_reports) {
+        mirror_reports_sent = 0; // the host counts acks from here
     }
+    send_raw_hid_reports = true;
+    suppress_real_reports = true;
+}
+
+static void host_mode_off(uint8_t *data, uint8_t length) {
+    host_failover();
 }
 
-static void shared_keys_send(void) {
-    memset(raw_hid_report, 0, sizeof(raw_hid_report));
-    raw_hid_report[0] = 0xC0;
-    raw_hid_report[1] = shared_keys_local & 0xFF;
-    raw_hid_report[2] = (shared_keys_local >> 8) & 0xFF;
-    raw_hid_report[3] = (shared_keys_local >> 16) & 0xFF;
-    raw_hid_report[4] = (shared_keys_local >> 24) & 0xFF;
-    raw_hid_send(raw_hid_report, RAW_EPSIZE);
+static void report_ack(uint8_t *data, uint8_t length) {
+    pending_reports_ack(data[1] | (data[2] << 8));
 }
 
-static void shared_key_event(uint8_t key, bool pressed) {
+const raw_hid_command_t PROGMEM raw_hid_commands_user[] = {
+    {RAW_HID_CMD_HOST_MODE_ON, 1, host_mode_on},
+    {RAW_HID_CMD_HOST_MODE_OFF, 1, host_mode_off},
+    {RAW_HID_CMD_REPORT_ACK, 3, report_ack},
+};
+const uint8_t raw_hid_commands_user_count = sizeof(raw_hid_commands_user) / sizeof(raw_hid_commands_user[0]);
+
+void housekeeping_task_user() {
+    if (!shared_keys_host_connected()) {
+        host_failover();
+    } else if (pending_reports_count > 0 && timer_elapsed(pending_reports[pending_reports_head].time) > ack_timeout_ms) {
+        host_failover();
+    }
+    shared_keys_task();
+    matrix_stream_task();
+    macro_player_task();
+    latency_stats_task();
+    raw_hid_queue_task();
+}
+
+void shared_key_event(uint8_t key, bool pressed) {
     action_t action = {};
     switch (key) {
         default:
@@ -558,71 +595,63 @@ static void shared_key_event(uint8_t key, bool pressed) {
     process_action(&record, action);
 }
 
+// Extra usages and the keycodes they come from, sorted by usage for the binary
+// search in USAGE2KEYCODE.
+#define EXTRA_USAGES(X) \
+    X(BRIGHTNESS_UP,               KC_BRIGHTNESS_UP) \
+    X(BRIGHTNESS_DOWN,             KC_BRIGHTNESS_DOWN) \
+    X(SYSTEM_POWER_DOWN,           KC_SYSTEM_POWER) \
+    X(SYSTEM_SLEEP,                KC_SYSTEM_SLEEP) \
+    X(SYSTEM_WAKE_UP,              KC_SYSTEM_WAKE) \
+    X(TRANSPORT_FAST_FORWARD,      KC_MEDIA_FAST_FORWARD) \
+    X(TRANSPORT_REWIND,            KC_MEDIA_REWIND) \
+    X(TRANSPORT_NEXT_TRACK,        KC_MEDIA_NEXT_TRACK) \
+    X(TRANSPORT_PREV_TRACK,        KC_MEDIA_PREV_TRACK) \
+    X(TRANSPORT_STOP,              KC_MEDIA_STOP) \
+    X(TRANSPORT_STOP_EJECT,        KC_MEDIA_EJECT) \
+    X(TRANSPORT_PLAY_PAUSE,        KC_MEDIA_PLAY_PAUSE) \
+    X(AUDIO_MUTE,                  KC_AUDIO_MUTE) \
+    X(AUDIO_VOL_UP,                KC_AUDIO_VOL_UP) \
+    X(AUDIO_VOL_DOWN,              KC_AUDIO_VOL_DOWN) \
+    X(AL_CC_CONFIG,                KC_MEDIA_SELECT) \
+    X(AL_EMAIL,                    KC_MAIL) \
+    X(AL_CALCULATOR,               KC_CALCULATOR) \
+    X(AL_LOCAL_BROWSER,            KC_MY_COMPUTER) \
+    X(AL_CONTROL_PANEL,            KC_CONTROL_PANEL) \
+    X(AL_ASSISTANT,                KC_ASSISTANT) \
+    X(AC_SEARCH,                   KC_WWW_SEARCH) \
+    X(AC_HOME,                     KC_WWW_HOME) \
+    X(AC_BACK,                     KC_WWW_BACK) \
+    X(AC_FORWARD,                  KC_WWW_FORWARD) \
+    X(AC_STOP,                     KC_WWW_STOP) \
+    X(AC_REFRESH,                  KC_WWW_REFRESH) \
+    X(AC_BOOKMARKS,                KC_WWW_FAVORITES) \
+    X(AC_DESKTOP_SHOW_ALL_WINDOWS, KC_MISSION_CONTROL) \
+    X(AC_SOFT_KEY_LEFT,            KC_LAUNCHPAD)
+
+#define EXTRA_USAGE(usage, keycode) usage,
+#define EXTRA_KEYCODE(usage, keycode) keycode,
+static const uint16_t PROGMEM extra_usages[]   = {EXTRA_USAGES(EXTRA_USAGE)};
+static const uint8_t PROGMEM  extra_keycodes[] = {EXTRA_USAGES(EXTRA_KEYCODE)};
+// Expands to 0 < u0 && u0 < u1 && ... && un <= UINT16_MAX.
+#define EXTRA_USAGE_LESS(usage, keycode) < (uint16_t)(usage) && (uint16_t)(usage)
+static_assert(0 EXTRA_USAGES(EXTRA_USAGE_LESS) <= UINT16_MAX, "EXTRA_USAGES must be sorted by usage");
+
 uint8_t USAGE2KEYCODE(uint16_t usage) {
-    switch (usage) {
-        case SYSTEM_POWER_DOWN:
-            return KC_SYSTEM_POWER;
-        case SYSTEM_SLEEP:
-            return KC_SYSTEM_SLEEP;
-        case SYSTEM_WAKE_UP:
-            return KC_SYSTEM_WAKE;
-        case AUDIO_MUTE:
-            return KC_AUDIO_MUTE;
-        case AUDIO_VOL_UP:
-            return KC_AUDIO_VOL_UP;
-        case AUDIO_VOL_DOWN:
-            return KC_AUDIO_VOL_DOWN;
-        case TRANSPORT_NEXT_TRACK:
-            return KC_MEDIA_NEXT_TRACK;
-        case TRANSPORT_PREV_TRACK:
-            return KC_MEDIA_PREV_TRACK;
-        case TRANSPORT_FAST_FORWARD:
-            return KC_MEDIA_FAST_FORWARD;
-        case TRANSPORT_REWIND:
-            return KC_MEDIA_REWIND;
-        case TRANSPORT_STOP:
-            return KC_MEDIA_STOP;
-        case TRANSPORT_STOP_EJECT:
-            return KC_MEDIA_EJECT;
-        case TRANSPORT_PLAY_PAUSE:
-            return KC_MEDIA_PLAY_PAUSE;
-        case AL_CC_CONFIG:
-            return KC_MEDIA_SELECT;
-        case AL_EMAIL:
-            return KC_MAIL;
-        case AL_CALCULATOR:
-            return KC_CALCULATOR;
-        case AL_LOCAL_BROWSER:
-            return KC_MY_COMPUTER;
-        case AL_CONTROL_PANEL:
-            return KC_CONTROL_PANEL;
-        case AL_ASSISTANT:
-            return KC_ASSISTANT;
-        case AC_SEARCH:
-            return KC_WWW_SEARCH;
-        case AC_HOME:
-            return KC_WWW_HOME;
-        case AC_BACK:
-            return KC_WWW_BACK;
-        case AC_FORWARD:
-            return KC_WWW_FORWARD;
-        case AC_STOP:
-            return KC_WWW_STOP;
-        case AC_REFRESH:
-            return KC_WWW_REFRESH;
-        case BRIGHTNESS_UP:
-            return KC_BRIGHTNESS_UP;
-        case BRIGHTNESS_DOWN:
-            return KC_BRIGHTNESS_DOWN;
-        case AC_BOOKMARKS:
-            return KC_WWW_FAVORITES;
-        case AC_DESKTOP_SHOW_ALL_WINDOWS:
-            return KC_MISSION_CONTROL;
-        case AC_SOFT_KEY_LEFT:
-            return KC_LAUNCHPAD;
-        default:
-            return 0;
+    uint8_t lo = 0;
+    uint8_t hi = ARRAY_SIZE(extra_usages);
+    while (lo < hi) {
+        uint8_t mid = (lo + hi) / 2;
+        uint16_t found = pgm_read_word(&extra_usages[mid]);
+        if (found == usage) {
+            return pgm_read_byte(&extra_keycodes[mid]);
+        } else if (found < usage) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
     }
+    return 0;
 }
 
 enum {
@@ -793,10 +822,23 @@ const uint16_t PROGMEM keymaps[][MATRIX_ROWS][MATRIX_COLS] = {
     ),
 };
 
+#ifdef TYPING_STATS_ENABLE
+// Fingers for same-finger bigrams, left pinky to right pinky; thumbs left out.
+const uint8_t PROGMEM typing_stats_fingers[MATRIX_ROWS][MATRIX_COLS] = LAYOUT_split_3x6_3(
+    1, 1, 2, 3, 4, 4,   5, 5, 6, 7, 8, 8,
+    1, 1, 2, 3, 4, 4,   5, 5, 6, 7, 8, 8,
+    1, 1, 2, 3, 4, 4,   5, 5, 6, 7, 8, 8,
+                0, 0, 0,   0, 0, 0
+);
+#endif
+
+// Leader sequences are in magic.rules, with the magic key's.
+void leader_start_user(void) {
+    magic_leader_start();
+}
+
 void leader_end_user(void) {
-    if (leader_sequence_two_keys(KC_W, KC_I)) {
-        SEND_STRING("windexlight");
-    }
+    magic_leader_end();
 }
 
 bool caps_word_press_user(uint16_t keycode) {
@@ -811,182 +853,31 @@ bool caps_word_press_user(uint16_t keycode) {
         case KC_BSPC:
         case KC_DEL:
         case KC_UNDS:
-        // https://github.com/getreuer/qmk-keymap/blob/main/getreuer.c
-        case M_THE:
-        case M_ION:
-        case M_MENT:
-        case M_QUEN:
-        case M_TMENT:
             return true;
 
         default:
-            return false;  // Deactivate Caps Word.
+            // Deactivate Caps Word, unless a magic string says otherwise.
+            return magic_caps_word_continues(keycode);
     }
 }
 
 
-// https://github.com/getreuer/qmk-keymap/blob/main/getreuer.c
-// The following describes the magic key functionality, where * represents the
-// magic key and @ the repeat key. For example, tapping A and then the magic key
-// types "ao". Most of this is coded in my `get_alt_repeat_key_keycode_user()`
-// definition below.
-//
-// SFB removal and common n-grams:
-//
-//     A * -> AO     L * -> LK      S * -> SK
-//     C * -> CY     M * -> MENT    T * -> TMENT
-//     D * -> DY     O * -> OA      U * -> UE
-//     E * -> EU     P * -> PY      Y * -> YP
-//     G * -> GY     Q * -> QUEN    spc * -> THE
-//     I * -> ION    R * -> RL
-//
-// When the magic key types a letter, following it with the repeat key produces
-// "n". This is useful to type certain patterns without SFBs.
-//
-//     A * @ -> AON             (like "kaon")
-//     D * @ -> DYN             (like "dynamic")
-//     E * @ -> EUN             (like "reunite")
-//     O * @ -> OAN             (like "loan")
-//
-// Other patterns:
-//
-//     spc * @ -> THEN
-//     I * @ -> IONS            (like "nations")
-//     M * @ -> MENTS           (like "moments")
-//     Q * @ -> QUENC           (like "frequency")
-//     T * @ -> TMENTS          (like "adjustments")
-//     = *   -> ===             (JS code)
-//     ! *   -> !==             (JS code)
-//     " *   -> """<cursor>"""  (Python code)
-//     ` *   -> ```<cursor>```  (Markdown code)
-//     # *   -> #include        (C code)
-//     & *   -> &nbsp;          (HTML code)
-//     . *   -> ../             (shell)
-//     . * @ -> ../../
+// The magic key rules, and the repeat key's, are in magic.rules. Rules written
+// over raw HID come first.
 uint16_t get_alt_repeat_key_keycode_user(uint16_t keycode, uint8_t mods) {
-    keycode = get_tap_keycode(keycode);
-
-    if (mods == MOD_BIT_LALT) {
-        switch (keycode) {
-        case KC_U: return A(KC_O);
-        case KC_O: return A(KC_U);
-        case KC_N: return A(KC_I);
-        case KC_I: return A(KC_N);
-        }
-    } else if ((mods & ~MOD_MASK_SHIFT) == 0) {
-        // This is where most of the "magic" for the MAGIC key is implemented.
-        switch (keycode) {
-        case KC_SPC:  // spc -> THE
-        case KC_ENT:
-        case KC_TAB:
-            if ((mods & MOD_MASK_SHIFT) == 0) {
-                return M_THE;
-            } else {
-                return M_CAP_THE;
-            }
-
-        // For navigating next/previous search results in Vim:
-        // N -> Shift + N, Shift + N -> N.
-        // case KC_N:
-        //     if ((mods & MOD_MASK_SHIFT) == 0) {
-        //         return S(KC_N);
-        //     }
-        //     return KC_N;
-
-        // Fix SFBs and awkward strokes.
-        case KC_A: return KC_O;         // A -> O
-        case KC_O: return KC_A;         // O -> A
-        case KC_E: return KC_U;         // E -> U
-        case KC_U: return KC_E;         // U -> E
-        case KC_I:
-            if ((mods & MOD_MASK_SHIFT) == 0) {
-                return M_ION;  // I -> ON
-            } else {
-                return KC_QUOT;  // Shift I -> '
-            }
-        case KC_M: return M_MENT;       // M -> ENT
-        case KC_Q: return M_QUEN;       // Q -> UEN
-        case KC_T: return M_TMENT;      // T -> TMENT
-
-        case KC_C: return KC_Y;         // C -> Y
-        case KC_D: return KC_Y;         // D -> Y
-        case KC_G: return KC_Y;         // G -> Y
-        case KC_P: return KC_Y;         // P -> Y
-        case KC_Y: return KC_P;         // Y -> P
-
-        case KC_L: return KC_K;         // L -> K
-        case KC_S: return KC_K;         // S -> K
-
-        case KC_R: return KC_L;         // R -> L
-        case KC_DOT:
-            if ((mods & MOD_MASK_SHIFT) == 0) {
-                return M_UPDIR;  // . -> ./
-            }
-            return M_NOOP;
-        case KC_HASH: return M_INCLUDE;  // # -> include
-        case KC_AMPR: return M_NBSP;     // & -> nbsp;
-        case KC_EQL: return M_EQEQ;      // = -> ==
-        case KC_RBRC: return KC_SCLN;    // ] -> ;
-        //   case KC_AT: return USRNAME;      // @ -> <username>
-
-        // Additions from https://github.com/Ikcelaks/keyboard_layouts/blob/main/magic_sturdy/magic_sturdy.md
-        case KC_B:    return M_BEFORE;
-        case KC_K:    return KC_S;
-        case KC_J:    return M_JUST;
-        case KC_N:    return M_NION;
-        case KC_V:    return M_VER;
-        case KC_W:    return M_WHICH;
-        case KC_X:    return M_XES;
-        case KC_COMM: return M_BUT;
-
-        case KC_QUOT:
-            if ((mods & MOD_MASK_SHIFT) != 0) {
-                return M_DOCSTR;  // " -> ""<cursor>"""
-            }
-            return M_VE;
-        case M_LL:
-            return M_VE;
-        case KC_GRV:  // ` -> ``<cursor>``` (for Markdown code)
-            return M_MKGRVS;
-        // case KC_LABK:  // < -> - (for Haskell)
-        //     return KC_MINS;
-        // case KC_SLSH:
-        //     return KC_SLSH;  // / -> / (easier reach than Repeat)
-
-        case KC_PLUS:
-        case KC_MINS:
-        case KC_ASTR:
-        case KC_PERC:
-        case KC_PIPE:
-        case KC_CIRC:
-        case KC_TILD:
-        case KC_EXLM:
-        case KC_DLR:
-        case KC_LABK:
-        case KC_RABK:
-        case KC_LPRN:
-        case KC_RPRN:
-        case KC_UNDS:
-        case KC_COLN:
-        case KC_SLSH:
-            return KC_EQL;
-
-        case KC_F:
-        case KC_Z:
-        case KC_H:
-        case KC_SCLN:
-        case KC_1 ... KC_0:
-            return M_NOOP;
-        }
+#ifdef RUNTIME_RULES_ENABLE
+    uint16_t runtime = runtime_rules_alt_repeat_keycode(keycode, mods);
+    if (runtime != KC_TRNS) {
+        return runtime;
     }
-
+#endif
     //   switch (keycode) {
     //     case MS_WHLU: return MS_WHLD;
     //     case MS_WHLD: return MS_WHLU;
     //     case SELWBAK: return SELWORD;
     //     case SELWORD: return SELWBAK;
     //   }
-    return KC_TRNS;
+    return magic_alt_repeat_keycode(keycode, mods);
 }
 
 bool get_speculative_hold(uint16_t keycode, keyrecord_t* record) {
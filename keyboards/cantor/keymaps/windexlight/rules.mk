@@ -7,3 +7,10 @@ LEADER_ENABLE = yes
 # CONSOLE_ENABLE = yes
 TAP_DANCE_ENABLE = yes
 KEY_OVERRIDE_ENABLE = yes
+# Bigram, same-finger and magic rule counts over raw HID; see users/windexlight/typing_stats.h.
+TYPING_STATS_ENABLE = yes
+# Alt repeat rules and key overrides over raw HID, without reflashing; see
+# users/windexlight/runtime_rules.h.
+RUNTIME_RULES_ENABLE = yes
+# Magic and repeat key rules, compiled by users/windexlight/rules.mk.
+MAGIC_RULES := $(dir $(lastword $(MAKEFILE_LIST)))magic.rules
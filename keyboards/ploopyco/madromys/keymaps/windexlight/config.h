@@ -12,3 +12,4 @@
 #define TAPPING_TERM 300
 #define TAPPING_TERM_PER_KEY
 
+#define SHARED_KEYS_DEVICE_ID 2
@@ -0,0 +1,54 @@
+#include "key_trace.h"
+#include "quantum.h"
+#include "raw_hid_commands.h"
+#include "raw_hid_queue.h"
+#include "usb_descriptor.h"
+#include <assert.h>
+#include <string.h>
+
+static_assert(sizeof(key_trace_entry_t) == 8, "host decoders rely on the entry layout");
+static_assert(KEY_TRACE_FRAME_HEADER + KEY_TRACE_FRAME_ENTRIES * sizeof(key_trace_entry_t) <= RAW_EPSIZE, "a frame must fit in one report");
+static_assert(KEY_TRACE_SIZE <= 128 && (KEY_TRACE_SIZE & (KEY_TRACE_SIZE - 1)) == 0, "KEY_TRACE_SIZE must be a power of two up to 128");
+
+static key_trace_entry_t trace[KEY_TRACE_SIZE];
+static uint8_t           trace_head    = 0; // next slot written
+static uint8_t           trace_count   = 0;
+static uint16_t          trace_dropped = 0;
+
+void key_trace_record(uint16_t keycode, keyrecord_t *record) {
+    key_trace_entry_t *entry = &trace[trace_head];
+    entry->keycode           = keycode;
+    entry->time              = record->event.time;
+    entry->row               = record->event.key.row;
+    entry->col               = record->event.key.col;
+    entry->flags             = record->event.pressed | (record->tap.interrupted << 1) | (record->tap.count << KEY_TRACE_COUNT_SHIFT);
+    entry->layer             = get_highest_layer(layer_state | default_layer_state);
+    trace_head               = (trace_head + 1) & (KEY_TRACE_SIZE - 1);
+    if (trace_count < KEY_TRACE_SIZE) {
+        trace_count++;
+    } else if (trace_dropped < UINT16_MAX) {
+        trace_dropped++;
+    }
+}
+
+void key_trace_drain(uint8_t *data, uint8_t length) {
+    uint8_t frames = length >= 2 && data[1] ? data[1] : KEY_TRACE_DRAIN_FRAMES;
+    do {
+        uint8_t frame[RAW_EPSIZE] = {RAW_HID_CMD_KEY_TRACE};
+        uint8_t count             = trace_count < KEY_TRACE_FRAME_ENTRIES ? trace_count : KEY_TRACE_FRAME_ENTRIES;
+        uint8_t tail              = (trace_head - trace_count) & (KEY_TRACE_SIZE - 1);
+        for (uint8_t i = 0; i < count; i++) {
+            memcpy(&frame[KEY_TRACE_FRAME_HEADER + i * sizeof(key_trace_entry_t)], &trace[(tail + i) & (KEY_TRACE_SIZE - 1)], sizeof(key_trace_entry_t));
+        }
+        frame[1] = count;
+        frame[2] = trace_count - count;
+        frame[3] = trace_dropped & 0xFF;
+        frame[4] = trace_dropped >> 8;
+        // With the queue full, the entries stay in the ring for the next drain.
+        if (!raw_hid_queue_send(frame, RAW_EPSIZE)) {
+            return;
+        }
+        trace_count -= count;
+        trace_dropped = 0;
+    } while (trace_count > 0 && --frames > 0);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Ring of the most recent key events, as process_record_user saw them. Recording
+// is a handful of stores, so unlike console logging it can stay on and leaves
+// the timing it is meant to diagnose alone. The host drains it over raw HID:
+//     [0xC6, max_frames] -> max_frames x [0xC6, count, remaining, dropped lo, dropped hi, count x entry]
+// Entries are oldest first. remaining is what is still buffered after the
+// frame, dropped counts entries overwritten since the previous drain. Frames
+// that find the raw HID queue full are not sent, and their entries stay
+// buffered for the next drain.
+
+// Entries kept, a power of two up to 128.
+#ifndef KEY_TRACE_SIZE
+#    define KEY_TRACE_SIZE 64
+#endif
+
+// Frames sent per request when the host does not say.
+#define KEY_TRACE_DRAIN_FRAMES 8
+
+// Entry flags.
+#define KEY_TRACE_PRESSED 0x01
+#define KEY_TRACE_INTERRUPTED 0x02
+#define KEY_TRACE_COUNT_SHIFT 4 // tap count in the high nibble
+
+typedef struct __attribute__((packed)) {
+    uint16_t keycode;
+    uint16_t time;  // event time, timer_read() at the scan that saw it
+    uint8_t  row;
+    uint8_t  col;
+    uint8_t  flags;
+    uint8_t  layer; // highest active layer, default layer included
+} key_trace_entry_t;
+
+#define KEY_TRACE_FRAME_HEADER 5
+#define KEY_TRACE_FRAME_ENTRIES 3 // per 32 byte report
+
+// Firmware side; host tools include this for the format only.
+#ifdef QMK_KEYBOARD_H
+#    include "action.h"
+
+// Call first thing in process_record_user.
+void key_trace_record(uint16_t keycode, keyrecord_t *record);
+#endif
+
+// Handler for RAW_HID_CMD_KEY_TRACE.
+void key_trace_drain(uint8_t *data, uint8_t length);
@@ -0,0 +1,136 @@
+#include "latency_stats.h"
+#include "quantum.h"
+#include "raw_hid_commands.h"
+#include "raw_hid_queue.h"
+#include "timer.h"
+#include "usb_descriptor.h"
+#include <string.h>
+
+#ifdef PROTOCOL_CHIBIOS
+#    include <ch.h>
+#    include <hal.h>
+#endif
+
+#if defined(PROTOCOL_CHIBIOS) && PORT_SUPPORTS_RT == TRUE && defined(STM32_HCLK)
+// The DWT cycle counter, which ChibiOS keeps running as its realtime counter.
+#    define STATS_CLOCK_KHZ (STM32_HCLK / 1000)
+uint32_t latency_stats_now(void) {
+    return chSysGetRealtimeCounterX();
+}
+#elif defined(PROTOCOL_CHIBIOS) && CH_CFG_ST_RESOLUTION == 32
+// System time, 1 MHz on the RP2040.
+#    define STATS_CLOCK_KHZ (CH_CFG_ST_FREQUENCY / 1000)
+uint32_t latency_stats_now(void) {
+    return chVTGetSystemTimeX();
+}
+#else
+#    define STATS_CLOCK_KHZ 1
+uint32_t latency_stats_now(void) {
+    return timer_read32();
+}
+#endif
+
+// Matrix events not yet seen by process_record_user, at most one per key held
+// in the tap-hold buffer, oldest overwritten.
+#define PENDING_EVENTS 8
+
+typedef struct {
+    uint8_t  row;
+    uint8_t  col;
+    bool     pressed;
+    bool     valid;
+    uint32_t time;
+} pending_event_t;
+
+static latency_stats_t stats;
+static uint32_t        stats_since    = 0;
+static uint32_t        last_scan      = 0;
+static bool            last_scan_seen = false;
+
+static pending_event_t pending_events[PENDING_EVENTS];
+static uint8_t         pending_next   = 0;
+static uint32_t        report_since   = 0;
+static bool            report_pending = false;
+
+void latency_stats_add(uint8_t stat, uint32_t ticks) {
+    latency_stat_t *entry = &stats.stats[stat];
+    entry->count++;
+    entry->total += ticks;
+    if (ticks > entry->max) {
+        entry->max = ticks;
+    }
+}
+
+void latency_stats_key_event(keyrecord_t *record, bool replayed) {
+    // An event held back and replayed keeps its first time. A new one takes
+    // over the entry of an event that never reached process_record_user, such
+    // as a key override's trigger, rather than being timed from it.
+    pending_event_t *event = NULL;
+    for (uint8_t i = 0; i < PENDING_EVENTS; i++) {
+        if (pending_events[i].valid && pending_events[i].row == record->event.key.row && pending_events[i].col == record->event.key.col && pending_events[i].pressed == record->event.pressed) {
+            event = &pending_events[i];
+            break;
+        }
+    }
+    if (event && replayed) {
+        return;
+    }
+    if (!event) {
+        event        = &pending_events[pending_next];
+        pending_next = (pending_next + 1) % PENDING_EVENTS;
+    }
+    event->row     = record->event.key.row;
+    event->col     = record->event.key.col;
+    event->pressed = record->event.pressed;
+    event->valid   = true;
+    event->time    = latency_stats_now();
+}
+
+void latency_stats_key_processed(keyrecord_t *record) {
+    report_pending = false;
+    for (uint8_t i = 0; i < PENDING_EVENTS; i++) {
+        pending_event_t *event = &pending_events[i];
+        if (event->valid && event->row == record->event.key.row && event->col == record->event.key.col && event->pressed == record->event.pressed) {
+            event->valid   = false;
+            report_since   = event->time;
+            report_pending = true;
+            return;
+        }
+    }
+}
+
+void latency_stats_report_sent(void) {
+    if (report_pending) {
+        report_pending = false;
+        latency_stats_add(LATENCY_KEY_TO_REPORT, latency_stats_now() - report_since);
+    }
+}
+
+void latency_stats_task(void) {
+    uint32_t now = latency_stats_now();
+    if (last_scan_seen) {
+        latency_stats_add(LATENCY_SCAN, now - last_scan);
+    }
+    last_scan      = now;
+    last_scan_seen = true;
+}
+
+void latency_stats_reset(void) {
+    memset(&stats, 0, sizeof(stats));
+    stats_since    = timer_read32();
+    last_scan_seen = false;
+}
+
+void latency_stats_receive(uint8_t *data, uint8_t length) {
+    stats.clock_khz  = STATS_CLOCK_KHZ;
+    stats.elapsed_ms = timer_elapsed32(stats_since);
+    for (uint8_t offset = 0; offset < sizeof(stats); offset += RAW_EPSIZE - LATENCY_STATS_FRAME_HEADER) {
+        uint8_t frame[RAW_EPSIZE] = {RAW_HID_CMD_LATENCY_STATS, offset};
+        uint8_t size              = sizeof(stats) - offset < RAW_EPSIZE - LATENCY_STATS_FRAME_HEADER ? sizeof(stats) - offset : RAW_EPSIZE - LATENCY_STATS_FRAME_HEADER;
+        memcpy(&frame[LATENCY_STATS_FRAME_HEADER], (uint8_t *)&stats + offset, size);
+        raw_hid_queue_send(frame, RAW_EPSIZE);
+    }
+    if (length >= 2 && data[1]) {
+        latency_stats_reset();
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Hot-path timing counters. Each stat keeps a count, the worst case and the
+// total, in ticks of the stats clock: the CPU cycle counter where there is one,
+// else the finest system timer. The host reads them over raw HID:
+//     [0xC7, reset] -> [0xC7, offset, up to 30 bytes of latency_stats_t from offset]...
+// until the whole block is sent, then resets the stats if reset is nonzero.
+
+enum latency_stat {
+    LATENCY_SCAN,           // main loop period, between housekeeping calls
+    LATENCY_PROCESS_RECORD, // time spent in process_record_user
+    LATENCY_KEY_TO_REPORT,  // matrix event to the keyboard report it caused, tap-hold waits included
+    LATENCY_RAW_HID_SEND,   // time blocked in raw_hid_send
+    LATENCY_STAT_COUNT,
+};
+
+typedef struct __attribute__((packed)) {
+    uint32_t count;
+    uint32_t max;
+    uint64_t total;
+} latency_stat_t;
+
+// Little-endian on the wire.
+typedef struct __attribute__((packed)) {
+    uint32_t       clock_khz;  // stats clock ticks per millisecond
+    uint32_t       elapsed_ms; // since the last reset
+    latency_stat_t stats[LATENCY_STAT_COUNT];
+} latency_stats_t;
+
+#define LATENCY_STATS_FRAME_HEADER 2
+
+// Firmware side; host tools include this for the format only.
+#ifdef QMK_KEYBOARD_H
+#    include "action.h"
+
+// Call from pre_process_record_user, which sees events as the matrix produces
+// them, before tap-hold buffering. replayed is true for an event the macro
+// player held back and now replays, which is timed from when it first came.
+void latency_stats_key_event(keyrecord_t *record, bool replayed);
+// Call at the start of process_record_user. The next keyboard report is timed
+// from this record's matrix event.
+void latency_stats_key_processed(keyrecord_t *record);
+#endif
+
+uint32_t latency_stats_now(void);
+void     latency_stats_add(uint8_t stat, uint32_t ticks);
+// Call from the keyboard and NKRO report interposers.
+void latency_stats_report_sent(void);
+// Call once per scan from housekeeping_task_user.
+void latency_stats_task(void);
+void latency_stats_reset(void);
+// Handler for RAW_HID_CMD_LATENCY_STATS.
+void latency_stats_receive(uint8_t *data, uint8_t length);
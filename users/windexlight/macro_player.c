@@ -0,0 +1,192 @@
+#include "macro_player.h"
+#include "quantum.h"
+#include "timer.h"
+#include <string.h>
+
+typedef struct {
+    const char  *string; // next character to type
+    macro_done_t done;
+    bool         shift; // weak Shift was on when queued, kept for every character
+    uint8_t      context[MACRO_PLAYER_CONTEXT_SIZE] __attribute__((aligned(4)));
+} macro_t;
+
+static macro_t  macros[MACRO_PLAYER_QUEUE_SIZE];
+static uint8_t  macros_head  = 0;
+static uint8_t  macros_count = 0;
+static uint16_t next_step    = 0; // timer_read() the next character is due at
+
+static keyevent_t held_events[MACRO_PLAYER_HELD_EVENTS];
+static uint8_t    held_count = 0;
+static bool       replaying  = false;
+
+bool macro_player_busy(void) {
+    return macros_count > 0;
+}
+
+bool macro_player_replaying(void) {
+    return replaying;
+}
+
+// Character keys are rolled: each report releases the previous character and
+// presses the next, so a run of distinct characters with the same shift state
+// takes one report per character instead of two. Only one key goes down per
+// report, so the host still sees them in order. A repeated character or a
+// change of shift releases first, in a report of its own.
+static uint8_t rolled_key   = KC_NO;
+static bool    rolled_shift = false; // the rolled character needs shift
+static bool    shift_added  = false; // and the player added it as a weak mod
+
+static void roll_press(uint8_t keycode, bool shift) {
+    if (rolled_key != KC_NO) {
+        del_key(rolled_key);
+    }
+    // Checked on every character, not just the first of a roll: a key pressed
+    // meanwhile clears the weak mods before the player holds it back.
+    if (shift && !(get_weak_mods() & MOD_MASK_SHIFT)) {
+        add_weak_mods(MOD_BIT(KC_LSFT));
+        shift_added = true;
+    }
+    add_key(keycode);
+    send_keyboard_report();
+    rolled_key   = keycode;
+    rolled_shift = shift;
+}
+
+static void roll_release(void) {
+    del_key(rolled_key);
+    if (shift_added) {
+        del_weak_mods(MOD_BIT(KC_LSFT));
+        shift_added = false;
+    }
+    send_keyboard_report();
+    rolled_key = KC_NO;
+}
+
+static void macro_finish(void) {
+    // The slot is free once popped, and done may queue another macro.
+    macro_t     *macro = &macros[macros_head];
+    macro_done_t done  = macro->done;
+    uint8_t      context[MACRO_PLAYER_CONTEXT_SIZE] __attribute__((aligned(4)));
+    memcpy(context, macro->context, sizeof(context));
+    macros_head = (macros_head + 1) % MACRO_PLAYER_QUEUE_SIZE;
+    macros_count--;
+    if (done) {
+        done(context);
+    }
+}
+
+// Sends the next report of the current macro, and finishes the macro if that
+// was its last.
+static void macro_step(bool blocking) {
+    macro_t *macro = &macros[macros_head];
+    char     code  = pgm_read_byte(macro->string);
+    next_step      = timer_read() + MACRO_PLAYER_INTERVAL_MS;
+    if (code != 0 && code != SS_QMK_PREFIX) {
+        uint8_t keycode = pgm_read_byte(&ascii_to_keycode_lut[(uint8_t)code]);
+        bool    shift   = macro->shift || ((pgm_read_byte(&ascii_to_shift_lut[(uint8_t)code / 8]) >> ((uint8_t)code % 8)) & 1);
+        if (keycode == KC_NO) {
+            macro->string++;
+        } else if (rolled_key == KC_NO || (keycode != rolled_key && shift == rolled_shift)) {
+            macro->string++;
+            roll_press(keycode, shift);
+        } else {
+            roll_release();
+        }
+        return;
+    }
+    if (rolled_key != KC_NO) {
+        roll_release();
+    } else if (code == SS_QMK_PREFIX) {
+        macro->string++;
+        code = pgm_read_byte(macro->string++);
+        if (code == SS_DELAY_CODE) {
+            uint16_t ms = 0;
+            for (char digit = pgm_read_byte(macro->string); digit >= '0' && digit <= '9'; digit = pgm_read_byte(++macro->string)) {
+                ms = ms * 10 + digit - '0';
+            }
+            if (pgm_read_byte(macro->string) == '|') {
+                macro->string++;
+            }
+            if (blocking) {
+                wait_ms(ms);
+            } else {
+                next_step = timer_read() + ms;
+            }
+        } else {
+            uint8_t keycode = pgm_read_byte(macro->string++);
+            switch (code) {
+                case SS_TAP_CODE:
+                    tap_code(keycode);
+                    break;
+                case SS_DOWN_CODE:
+                    register_code(keycode);
+                    break;
+                case SS_UP_CODE:
+                    unregister_code(keycode);
+                    break;
+            }
+        }
+    }
+    if (rolled_key == KC_NO && pgm_read_byte(macro->string) == 0) {
+        macro_finish();
+    }
+}
+
+// Plays everything queued to the end, as send_string would.
+static void macro_player_flush(void) {
+    while (macros_count > 0) {
+        macro_step(true);
+    }
+}
+
+void macro_send_P(const char *string, macro_done_t done, const void *context, uint8_t context_size) {
+    if (macros_count == MACRO_PLAYER_QUEUE_SIZE) {
+        macro_player_flush();
+    }
+    macro_t *macro = &macros[(macros_head + macros_count++) % MACRO_PLAYER_QUEUE_SIZE];
+    macro->string  = string;
+    macro->done    = done;
+    macro->shift   = get_weak_mods() & MOD_MASK_SHIFT;
+    memset(macro->context, 0, sizeof(macro->context));
+    if (context) {
+        memcpy(macro->context, context, context_size < sizeof(macro->context) ? context_size : sizeof(macro->context));
+    }
+    if (macros_count == 1) {
+        macro_step(false);
+    }
+}
+
+bool macro_player_pre_process(keyrecord_t *record) {
+    if (replaying || (macros_count == 0 && held_count == 0)) {
+        return true;
+    }
+    if (held_count == MACRO_PLAYER_HELD_EVENTS) {
+        macro_player_flush();
+        macro_player_task();
+        if (held_count == 0) {
+            return true;
+        }
+    }
+    held_events[held_count++] = record->event;
+    return false;
+}
+
+void macro_player_task(void) {
+    if (macros_count > 0 && (int16_t)(timer_read() - next_step) >= 0) {
+        macro_step(false);
+    }
+    // Replay held events until one of them starts another macro. Their times
+    // are refreshed so tap-hold does not count the wait against the tapping term.
+    uint8_t replayed = 0;
+    while (replayed < held_count && macros_count == 0) {
+        keyevent_t event = held_events[replayed++];
+        event.time       = timer_read() | 1;
+        replaying        = true;
+        action_exec(event);
+        replaying = false;
+    }
+    if (replayed > 0) {
+        held_count -= replayed;
+        memmove(held_events, &held_events[replayed], held_count * sizeof(keyevent_t));
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Types strings in the background. send_string blocks the main loop until the
+// last key is up; the player instead sends one report per
+// MACRO_PLAYER_INTERVAL_MS from housekeeping, so scanning and raw HID carry on.
+// Characters are rolled, see macro_player.c, which takes about half the
+// reports of tapping each one.
+// Key events that arrive meanwhile are held back and replayed, in order, once
+// the player is idle, so they land after the macro rather than inside it.
+
+#ifndef MACRO_PLAYER_QUEUE_SIZE
+#    define MACRO_PLAYER_QUEUE_SIZE 4
+#endif
+
+// Key events held back while a macro plays. If more arrive, the macro is
+// finished on the spot, as send_string would have done.
+#ifndef MACRO_PLAYER_HELD_EVENTS
+#    define MACRO_PLAYER_HELD_EVENTS 16
+#endif
+
+#ifndef MACRO_PLAYER_INTERVAL_MS
+#    define MACRO_PLAYER_INTERVAL_MS 1
+#endif
+
+// Bytes of context a macro carries for its done callback.
+#define MACRO_PLAYER_CONTEXT_SIZE 8
+
+// Called once the last character is typed, with a copy of the context given
+// to macro_send_P, aligned for any struct that fits.
+typedef void (*macro_done_t)(void *context);
+
+// Queues string, in PROGMEM and SEND_STRING syntax. done may be NULL. Typing
+// starts within this call when the player is idle. If the queue is full, the
+// macros already in it are typed to the end first. A weak Shift on when string
+// is queued shifts all of it, even if a key press clears it meanwhile.
+void macro_send_P(const char *string, macro_done_t done, const void *context, uint8_t context_size);
+bool macro_player_busy(void);
+// True while a held key event is replayed, from within its processing.
+bool macro_player_replaying(void);
+// Call once per scan from housekeeping_task_user.
+void macro_player_task(void);
+
+#define MACRO_STRING(string) macro_send_P(PSTR(string), NULL, NULL, 0)
+
+#ifdef QMK_KEYBOARD_H
+#    include "action.h"
+
+// Call from pre_process_record_user and return its result: false holds the
+// event back until the player is idle.
+bool macro_player_pre_process(keyrecord_t *record);
+#endif
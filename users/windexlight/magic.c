@@ -0,0 +1,380 @@
+#include "magic.h"
+#include "macro_player.h"
+#include "quantum.h"
+#include "typing_stats.h"
+#include <assert.h>
+#include <string.h>
+
+#define MAGIC_TABLES
+#include "magic_tables.h"
+
+#define RULE_COUNT(rules) (sizeof(rules) / sizeof(rules[0]))
+
+static_assert(MAGIC_STRING_COUNT <= QK_USER_MAX - QK_USER, "too many magic strings");
+static_assert((RULE_COUNT(magic_alt_contexts) & (RULE_COUNT(magic_alt_contexts) - 1)) == 0, "context tables are a power of two long");
+static_assert((RULE_COUNT(magic_repeat_contexts) & (RULE_COUNT(magic_repeat_contexts) - 1)) == 0, "context tables are a power of two long");
+
+#define TRIE_NONE 0xFFFF
+
+static_assert(MAGIC_HISTORY_SIZE >= MAGIC_CONTEXT_SIZE, "contexts are looked up in the history");
+
+// The last basic keycodes typed, in a ring, and the hash of the newest n + 1 of
+// them, oldest first, at history_hash[n].
+static uint8_t  history[MAGIC_HISTORY_SIZE];
+static uint16_t history_hash[MAGIC_CONTEXT_SIZE];
+static uint8_t  history_head;
+static uint8_t  history_length;
+
+static uint8_t history_key(uint8_t age) {
+    return history[(history_head + MAGIC_HISTORY_SIZE - age) % MAGIC_HISTORY_SIZE];
+}
+
+static void history_push(uint8_t key) {
+    for (uint8_t n = MAGIC_CONTEXT_SIZE - 1; n > 0; n--) {
+        history_hash[n] = history_hash[n - 1] * MAGIC_HASH_BASE + key;
+    }
+    history_hash[0]       = key;
+    history_head          = (history_head + 1) % MAGIC_HISTORY_SIZE;
+    history[history_head] = key;
+    if (history_length < MAGIC_HISTORY_SIZE) {
+        history_length++;
+    }
+}
+
+static void history_pop(void) {
+    if (history_length == 0) {
+        return;
+    }
+    history_head = (history_head + MAGIC_HISTORY_SIZE - 1) % MAGIC_HISTORY_SIZE;
+    history_length--;
+    // The oldest key weighs the most, so rehash what is left.
+    uint16_t hash = 0, weight = 1;
+    for (uint8_t n = 0; n < history_length && n < MAGIC_CONTEXT_SIZE; n++) {
+        hash += history_key(n) * weight;
+        weight *= MAGIC_HASH_BASE;
+        history_hash[n] = hash;
+    }
+}
+
+static void history_type(uint8_t keycode) {
+    if (keycode == KC_BSPC) {
+        history_pop();
+    } else if (keycode >= KC_A && keycode <= KC_SLSH) {
+        history_push(keycode);
+    } else {
+        history_length = 0; // arrows and the like move the cursor
+    }
+}
+
+// Updates the history with a key press that was not a magic string.
+static void history_record(uint16_t keycode, keyrecord_t *record) {
+    if (IS_QK_MOD_TAP(keycode) || IS_QK_LAYER_TAP(keycode)) {
+        if (record->tap.count == 0) {
+            return;
+        }
+        keycode = get_tap_keycode(keycode);
+    } else if (IS_QK_MODS(keycode) && (QK_MODS_GET_MODS(keycode) | MOD_RSFT) == MOD_RSFT) {
+        keycode = QK_MODS_GET_BASIC_KEYCODE(keycode);
+    }
+    if (keycode > QK_BASIC_MAX || IS_MODIFIER_KEYCODE(keycode) || keycode == KC_NO) {
+        return; // layer and custom keys, and mods, type nothing
+    }
+    if ((get_mods() | get_weak_mods() | get_oneshot_mods()) & ~MOD_MASK_SHIFT) {
+        history_length = 0; // a shortcut
+    } else {
+        history_type(keycode);
+    }
+}
+
+// Adds the keys of a string the macro player is about to type.
+static void history_record_string(const char *text) {
+    for (uint8_t c; (c = pgm_read_byte(text)) != 0; text++) {
+        if (c == SS_QMK_PREFIX) {
+            // Magic strings only tap keys, like {LEFT}, which moves the cursor.
+            history_length = 0;
+            text += 2;
+        } else if (c < 128 && pgm_read_byte(&ascii_to_keycode_lut[c]) != KC_NO) {
+            history_type(pgm_read_byte(&ascii_to_keycode_lut[c]));
+        }
+    }
+}
+
+// Longest context in the history found in table, or NULL.
+static const magic_context_t *context_find(const magic_context_t *table, uint16_t size) {
+    for (uint8_t n = history_length < MAGIC_CONTEXT_SIZE ? history_length : MAGIC_CONTEXT_SIZE; n >= 2; n--) {
+        for (uint16_t slot = history_hash[n - 1] & (size - 1);; slot = (slot + 1) & (size - 1)) {
+            const magic_context_t *context = &table[slot];
+            if (pgm_read_byte(&context->keys[0]) == 0) {
+                break;
+            }
+            uint8_t age = 0;
+            while (age < MAGIC_CONTEXT_SIZE && pgm_read_byte(&context->keys[age]) == (age < n ? history_key(age) : 0)) {
+                age++;
+            }
+            if (age == MAGIC_CONTEXT_SIZE) {
+                return context;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Child of node for key, by binary search, or TRIE_NONE.
+static uint16_t trie_child(const magic_trie_t *trie, uint16_t node, uint16_t key) {
+    uint16_t low  = pgm_read_word(&trie[node].children);
+    uint16_t high = low + pgm_read_byte(&trie[node].child_count);
+    while (low < high) {
+        uint16_t mid     = (low + high) / 2;
+        uint8_t  mid_key = pgm_read_byte(&trie[mid].key);
+        if (mid_key == key) {
+            return mid;
+        } else if (mid_key < key) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return TRIE_NONE;
+}
+
+// Node of the longest expansion the history ends with, or TRIE_NONE. The walk
+// is as deep as the match, however many expansions there are.
+static uint16_t expansion_find(void) {
+    uint16_t found = TRIE_NONE;
+    uint16_t node  = 0;
+    for (uint8_t age = 0; age < history_length; age++) {
+        node = trie_child(magic_expansion_trie, node, history_key(age));
+        if (node == TRIE_NONE) {
+            break;
+        }
+        if (pgm_read_word(&magic_expansion_trie[node].output) != KC_NO) {
+            found = node;
+        }
+    }
+    return found;
+}
+
+#ifdef TYPING_STATS_ENABLE
+// Hits of each magic.rules line, exported with the typing stats.
+static uint16_t rule_hits[MAGIC_RULE_COUNT];
+
+static void rule_hit(const uint16_t *ids, uint16_t index) {
+    uint16_t rule = pgm_read_word(&ids[index]);
+    if (rule_hits[rule] < UINT16_MAX) {
+        rule_hits[rule]++;
+    }
+}
+#    define RULE_HIT(ids, index) rule_hit(ids, index)
+
+uint16_t typing_stats_magic_rule_count(void) {
+    return MAGIC_RULE_COUNT;
+}
+
+uint16_t typing_stats_magic_rule_line(uint16_t rule) {
+    return pgm_read_word(&magic_rule_lines[rule]);
+}
+
+uint16_t typing_stats_magic_rule_hits(uint16_t rule) {
+    return rule_hits[rule];
+}
+
+void typing_stats_magic_reset(void) {
+    memset(rule_hits, 0, sizeof(rule_hits));
+}
+#else
+#    define RULE_HIT(ids, index)
+#endif
+
+// First rule for keycode whose mods match, by binary search on the keycode.
+static const magic_rule_t *rule_find(const magic_rule_t *rules, uint8_t count, uint16_t keycode, uint8_t mods) {
+    uint8_t low = 0, high = count;
+    while (low < high) {
+        uint8_t mid = (low + high) / 2;
+        if (pgm_read_word(&rules[mid].keycode) < keycode) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    for (; low < count && pgm_read_word(&rules[low].keycode) == keycode; low++) {
+        if ((mods & pgm_read_byte(&rules[low].mods_mask)) == pgm_read_byte(&rules[low].mods)) {
+            return &rules[low];
+        }
+    }
+    return NULL;
+}
+
+uint16_t magic_alt_repeat_keycode(uint16_t keycode, uint8_t mods) {
+    keycode = get_tap_keycode(keycode);
+    if (mods & MOD_MASK_SHIFT) {
+        mods |= MOD_MASK_SHIFT;
+    }
+    // The history, rather than keycode, has what the magic key typed last.
+    if ((mods & ~MOD_MASK_SHIFT) == 0) {
+        uint16_t node = expansion_find();
+        if (node != TRIE_NONE) {
+            RULE_HIT(magic_expansion_ids, node);
+            return pgm_read_word(&magic_expansion_trie[node].output);
+        }
+        const magic_context_t *context = context_find(magic_alt_contexts, RULE_COUNT(magic_alt_contexts));
+        if (context) {
+            RULE_HIT(magic_alt_context_ids, context - magic_alt_contexts);
+            return pgm_read_word(&context->output);
+        }
+    }
+    // QMK hands over the keycode as the key sent it, KC_HASH as LSFT(KC_3).
+    // Without a rule for it, its basic key is tried with its mods added.
+    const magic_rule_t *rule = rule_find(magic_alt_rules, RULE_COUNT(magic_alt_rules), keycode, mods);
+    if (!rule && IS_QK_MODS(keycode)) {
+        uint8_t keycode_mods = QK_MODS_GET_MODS(keycode);
+        mods |= keycode_mods & 0x10 ? (keycode_mods & 0x0F) << 4 : keycode_mods;
+        if (mods & MOD_MASK_SHIFT) {
+            mods |= MOD_MASK_SHIFT;
+        }
+        rule = rule_find(magic_alt_rules, RULE_COUNT(magic_alt_rules), QK_MODS_GET_BASIC_KEYCODE(keycode), mods);
+    }
+    if (!rule) {
+        return KC_TRNS;
+    }
+    RULE_HIT(magic_alt_rule_ids, rule - magic_alt_rules);
+    return pgm_read_word(&rule->output);
+}
+
+bool magic_caps_word_continues(uint16_t keycode) {
+    return IS_MAGIC_KEYCODE(keycode) && (pgm_read_byte(&magic_strings[keycode - MAGIC_KEYCODE_START].flags) & MAGIC_CAPS);
+}
+
+// https://github.com/getreuer/qmk-keymap/blob/main/getreuer.c
+// An enhanced version of SEND_STRING: if Caps Word is active, the Shift key is
+// held while sending the string. Additionally, the last key is set such that if
+// the Repeat Key is pressed next, it produces the string's next keycode.
+// windexlight modifications - clear non-shift mods. If the string has a shifted
+// form, clear shift as well and send that if shift was active.
+// The macro player types the string straight from the pool; the mods stay as
+// set here until it is done, then magic_send_done restores them.
+typedef struct {
+    uint16_t next;
+    uint8_t  mods;
+    uint8_t  oneshot_mods;
+    uint8_t  saved_mods;
+} magic_restore_t;
+
+static_assert(sizeof(magic_restore_t) <= MACRO_PLAYER_CONTEXT_SIZE, "magic_restore_t must fit a macro's context");
+
+static void magic_send_done(void *context) {
+    const magic_restore_t *restore = context;
+    set_last_keycode(restore->next);
+    set_last_mods(get_mods());
+    set_mods(restore->mods);
+    set_oneshot_mods(restore->oneshot_mods);
+
+#ifdef CAPS_WORD_ENABLE
+    // If Caps Word is on, restore the mods.
+    if (is_caps_word_on()) {
+        set_mods(restore->saved_mods);
+    }
+#endif
+}
+
+static void magic_send(const magic_string_t *string) {
+    const char *text  = &magic_pool[pgm_read_word(&string->text)];
+    uint8_t     flags = pgm_read_byte(&string->flags);
+    if (flags & MAGIC_RAW) {
+        history_record_string(text);
+        macro_send_P(text, NULL, NULL, 0);
+        return;
+    }
+    magic_restore_t restore = {.next = pgm_read_word(&string->next)};
+#ifdef CAPS_WORD_ENABLE
+    // If Caps Word is on, save the mods and hold Shift.
+    if (is_caps_word_on()) {
+        restore.saved_mods = get_mods();
+        register_mods(MOD_BIT_LSHIFT);
+    }
+#endif
+
+    // Unlike magic_send_string_P, weak mods are dropped rather than restored.
+    // They are the repeat key's last mods, which it takes back on release, but
+    // magic_send_done resets the last mods first. A restored weak Shift would
+    // then stay on and the next key would be remembered as shifted.
+    uint8_t weak_mods    = get_weak_mods();
+    restore.mods         = get_mods();
+    restore.oneshot_mods = get_oneshot_mods();
+    if (flags & (MAGIC_SAME_SHIFTED | MAGIC_SHIFTED)) {
+        clear_mods();
+        clear_weak_mods();
+        clear_oneshot_mods();
+        if ((flags & MAGIC_SHIFTED) && ((restore.mods | weak_mods | restore.oneshot_mods) & MOD_MASK_SHIFT) != 0) {
+            // Skip to the shifted form, which follows.
+            while (pgm_read_byte(text++) != 0) {
+            }
+        }
+        history_record_string(text);
+    } else {
+        set_mods(restore.mods & MOD_MASK_SHIFT);
+        set_weak_mods(weak_mods & MOD_MASK_SHIFT);
+        set_oneshot_mods(restore.oneshot_mods & MOD_MASK_SHIFT);
+        history_record_string(text);
+    }
+    macro_send_P(text, magic_send_done, &restore, sizeof(restore));
+}
+
+#ifdef LEADER_ENABLE
+// Node of magic_leader_trie the keys after the leader key have reached.
+static uint16_t leader_node = TRIE_NONE;
+
+void magic_leader_start(void) {
+    leader_node = 0;
+}
+
+void magic_leader_end(void) {
+    uint16_t output = leader_node == TRIE_NONE ? KC_NO : pgm_read_word(&magic_leader_trie[leader_node].output);
+    leader_node     = TRIE_NONE;
+    if (IS_MAGIC_KEYCODE(output)) {
+        magic_send(&magic_strings[output - MAGIC_KEYCODE_START]);
+    } else if (output != KC_NO) {
+        tap_code16(output);
+    }
+}
+#endif
+
+bool magic_process_record(uint16_t keycode, keyrecord_t *record) {
+    if (!record->event.pressed) {
+        return true;
+    }
+#ifdef LEADER_ENABLE
+    // QMK's leader takes the key after process_record_user returns; follow it
+    // down the trie, leaving the history alone.
+    if (leader_sequence_active() && !leader_sequence_timed_out()) {
+        if (leader_node != TRIE_NONE) {
+            leader_node = trie_child(magic_leader_trie, leader_node, get_tap_keycode(keycode));
+        }
+        return true;
+    }
+#endif
+    if (IS_MAGIC_KEYCODE(keycode)) {
+        magic_send(&magic_strings[keycode - MAGIC_KEYCODE_START]);
+        return false;
+    }
+    if (get_repeat_key_count() > 0) {
+        // Before the repeated key goes into the history.
+        uint16_t               output  = KC_NO;
+        const magic_context_t *context = context_find(magic_repeat_contexts, RULE_COUNT(magic_repeat_contexts));
+        if (context) {
+            RULE_HIT(magic_repeat_context_ids, context - magic_repeat_contexts);
+            output = pgm_read_word(&context->output);
+        } else {
+            const magic_rule_t *rule = rule_find(magic_repeat_rules, RULE_COUNT(magic_repeat_rules), keycode & 0xFF, 0);
+            if (rule) {
+                RULE_HIT(magic_repeat_rule_ids, rule - magic_repeat_rules);
+                output = pgm_read_word(&rule->output);
+            }
+        }
+        if (output != KC_NO) {
+            magic_send(&magic_strings[output - MAGIC_KEYCODE_START]);
+            return false;
+        }
+    }
+    history_record(keycode, record);
+    return true;
+}
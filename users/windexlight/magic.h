@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Magic (alt repeat) and repeat key rules, looked up in tables that
+// magic_gen.py generates from the keymap's magic.rules. A keymap enables this
+// by setting MAGIC_RULES in its rules.mk.
+#include "magic_tables.h"
+
+// Rules can also match a context, the last few basic keycodes typed. magic.c
+// keeps them in a ring, with the rolling hash of each run of the newest ones,
+// and looks the runs up in generated hash tables. The generator hashes the
+// same way.
+#define MAGIC_HASH_BASE 31
+
+// Expansions match the end of the same history, and leader sequences the keys
+// after the leader key, by walking a generated trie one key at a time.
+
+// Each string typed by a rule is a keycode, so the repeat keys can return and
+// remember it. They sit at the top of the user range, clear of the keymap's own
+// keycodes counting up from SAFE_RANGE.
+#define MAGIC_KEYCODE_START (QK_USER_MAX + 1 - MAGIC_STRING_COUNT)
+#define MAGIC_KEYCODE(index) (MAGIC_KEYCODE_START + (index))
+#define IS_MAGIC_KEYCODE(keycode) ((keycode) >= MAGIC_KEYCODE_START && (keycode) <= QK_USER_MAX)
+
+// magic_string_t flags.
+#define MAGIC_RAW 0x01          // typed as it is, mods and repeat key untouched
+#define MAGIC_CAPS 0x02         // continues Caps Word
+#define MAGIC_SAME_SHIFTED 0x04 // shift is cleared, the string typed either way
+#define MAGIC_SHIFTED 0x08      // shift is cleared, and the string after this one in the pool typed if it was held
+// Without either, shift is kept and applies to every character.
+
+// The strings are NUL-terminated in one PROGMEM pool, SEND_STRING syntax. A
+// string that ends another is stored once, as its tail.
+typedef struct {
+    uint16_t text; // offset in the pool
+    uint16_t next; // what the repeat key types afterwards
+    uint8_t  flags;
+} magic_string_t;
+
+typedef struct {
+    uint16_t keycode;   // previous key, tables sorted on it
+    uint8_t  mods_mask; // of its mods, with both shift bits set for either
+    uint8_t  mods;
+    uint16_t output;
+} magic_rule_t;
+
+typedef struct {
+    uint8_t  keys[MAGIC_CONTEXT_SIZE]; // newest first, zero after the oldest; an empty slot is all zero
+    uint16_t output;
+} magic_context_t;
+
+typedef struct {
+    uint8_t  key;         // 0 for the root
+    uint8_t  child_count; // children are next to each other, sorted on key
+    uint16_t children;    // index of the first
+    uint16_t output;      // KC_NO when no sequence ends here
+} magic_trie_t;
+
+// Return from get_alt_repeat_key_keycode_user; KC_TRNS when no rule matches.
+uint16_t magic_alt_repeat_keycode(uint16_t keycode, uint8_t mods);
+bool     magic_caps_word_continues(uint16_t keycode);
+
+// Call from leader_start_user and leader_end_user.
+void magic_leader_start(void);
+void magic_leader_end(void);
+
+#ifdef QMK_KEYBOARD_H
+#    include "action.h"
+
+// Call from process_record_user, for every key the context should see; false
+// when the event typed a magic string.
+bool magic_process_record(uint16_t keycode, keyrecord_t *record);
+#endif
@@ -0,0 +1,549 @@
+#!/usr/bin/env python3
+"""Compiles a keymap's magic.rules into the PROGMEM tables of magic.c.
+
+    magic_gen.py magic.rules magic_tables.h
+
+The output is only rewritten when it changes, so the build can run this on
+every invocation. See magic.rules in the Cantor keymap for the rule syntax.
+"""
+
+import re
+import sys
+
+# Keycode values, needed to sort the rule tables. The generated header checks
+# each one it uses against QMK's.
+BASIC_KEYCODES = {f'KC_{chr(ord("A") + i)}': 0x04 + i for i in range(26)}
+BASIC_KEYCODES.update({f'KC_{(i + 1) % 10}': 0x1E + i for i in range(10)})
+BASIC_KEYCODES.update({
+    'KC_ENT': 0x28, 'KC_ESC': 0x29, 'KC_BSPC': 0x2A, 'KC_TAB': 0x2B,
+    'KC_SPC': 0x2C, 'KC_MINS': 0x2D, 'KC_EQL': 0x2E, 'KC_LBRC': 0x2F,
+    'KC_RBRC': 0x30, 'KC_BSLS': 0x31, 'KC_SCLN': 0x33, 'KC_QUOT': 0x34,
+    'KC_GRV': 0x35, 'KC_COMM': 0x36, 'KC_DOT': 0x37, 'KC_SLSH': 0x38,
+})
+QK_LSFT = 0x0200
+SHIFTED_KEYCODES = {
+    'KC_TILD': 'KC_GRV', 'KC_EXLM': 'KC_1', 'KC_AT': 'KC_2', 'KC_HASH': 'KC_3',
+    'KC_DLR': 'KC_4', 'KC_PERC': 'KC_5', 'KC_CIRC': 'KC_6', 'KC_AMPR': 'KC_7',
+    'KC_ASTR': 'KC_8', 'KC_LPRN': 'KC_9', 'KC_RPRN': 'KC_0', 'KC_UNDS': 'KC_MINS',
+    'KC_PLUS': 'KC_EQL', 'KC_LCBR': 'KC_LBRC', 'KC_RCBR': 'KC_RBRC',
+    'KC_PIPE': 'KC_BSLS', 'KC_COLN': 'KC_SCLN', 'KC_DQUO': 'KC_QUOT',
+    'KC_LABK': 'KC_COMM', 'KC_RABK': 'KC_DOT', 'KC_QUES': 'KC_SLSH',
+}
+# Keys of the characters an expansion matches, typed without shift.
+CHAR_KEYCODES = {chr(ord('a') + i): f'KC_{chr(ord("A") + i)}' for i in range(26)}
+CHAR_KEYCODES.update({str((i + 1) % 10): f'KC_{(i + 1) % 10}' for i in range(10)})
+CHAR_KEYCODES.update({
+    ' ': 'KC_SPC', '-': 'KC_MINS', '=': 'KC_EQL', '[': 'KC_LBRC', ']': 'KC_RBRC',
+    '\\\\': 'KC_BSLS', ';': 'KC_SCLN', "'": 'KC_QUOT', '`': 'KC_GRV', ',': 'KC_COMM',
+    '.': 'KC_DOT', '/': 'KC_SLSH',
+})
+KEYCODES = dict(BASIC_KEYCODES)
+KEYCODES.update({name: QK_LSFT | BASIC_KEYCODES[base] for name, base in SHIFTED_KEYCODES.items()})
+ORDER = list(BASIC_KEYCODES)
+
+# Magic strings sort after every keycode, in index order.
+MAGIC_BASE = 0x10000
+
+# Must match magic.c: the hash of keys k1..kn, oldest first, is
+# (((k1 * 31) + k2) * 31 + ...) + kn, in 16 bits.
+HASH_BASE = 31
+
+# (mask, value) over mods with both shift bits set when either is.
+MODS = {
+    '': (0xDD, 0x00),
+    'noshift': (0xFF, 0x00),
+    'shift': (0xFF, 0x22),
+    'alt': (0xFF, 0x04),
+}
+
+TOKEN = re.compile(r'(?:\w+=)?"(?:[^"\\]|\\.)*"|\S+')
+# A character of a spec string: an escape, a {KEY} tap or a plain character.
+CHAR = re.compile(r'\\(?:x[0-9A-Fa-f]+|[0-7]{1,3}|.)|\{\w+\}|.', re.S)
+# Bytes of SS_TAP(X_KEY): SS_QMK_PREFIX, SS_TAP_CODE and the keycode.
+TAP_SIZE = 3
+
+
+class SpecError(Exception):
+    pass
+
+
+class MagicString:
+    def __init__(self, text, shifted, flags, next_ref):
+        self.text = text
+        self.shifted = shifted
+        self.flags = flags
+        self.next_ref = next_ref
+        self.index = None
+        self.key = None
+        self.offset = None
+
+
+class TypedText:
+    """Previous keys of an expansion: text typed just before the magic key."""
+
+    def __init__(self, chars):
+        self.text = ''.join(chars)
+        self.keys = []
+        for char in chars:
+            if char not in CHAR_KEYCODES:
+                raise SpecError(f'{char} in "{self.text}" is not typed by one key without shift')
+            self.keys.append(CHAR_KEYCODES[char])
+        self.keys = tuple(self.keys)
+        if not self.keys:
+            raise SpecError('"" expands nothing')
+
+
+class Strings:
+    def __init__(self):
+        self.entries = []
+        self.names = {}
+
+    def add(self, string, name=None):
+        if name:
+            if name in self.names:
+                raise SpecError(f'{name} defined twice')
+            self.names[name] = string
+        self.entries.append(string)
+        return string
+
+    def resolve(self, ref, default):
+        """C expression for a value: keycode name, string or name reference."""
+        if ref is None:
+            return default
+        if isinstance(ref, MagicString):
+            return f'MAGIC_KEYCODE({ref.index})'
+        if ref in self.names:
+            return f'MAGIC_KEYCODE({self.names[ref].index})'
+        return ref
+
+    def number(self):
+        """Merges identical strings, numbers them and returns one of each."""
+        canonical = {}
+        numbered = []
+
+        def merge(string, seen=()):
+            if id(string) in canonical:
+                return canonical[id(string)]
+            next_ref = string.next_ref
+            if isinstance(next_ref, str) and next_ref in self.names:
+                next_ref = self.names[next_ref]
+            if isinstance(next_ref, MagicString):
+                # A cycle through next keeps the strings on it apart.
+                next_ref = id(next_ref) if id(next_ref) in seen else id(merge(next_ref, seen + (id(string),)))
+            key = (string.text, string.shifted, tuple(sorted(string.flags)), next_ref)
+            for other in numbered:
+                if other.key == key:
+                    break
+            else:
+                other = string
+                other.key = key
+                other.index = len(numbered)
+                numbered.append(other)
+            canonical[id(string)] = other
+            return other
+
+        for string in self.entries:
+            merge(string)
+        for string in self.entries:
+            string.index = canonical[id(string)].index
+        return numbered
+
+
+def spec_chars(token):
+    """The characters of a quoted spec string, as a tuple of C source pieces."""
+    return tuple(CHAR.findall(token[1:-1]))
+
+
+def char_size(char):
+    return TAP_SIZE if char.startswith('{') else 1
+
+
+def chars_size(chars):
+    return sum(char_size(char) for char in chars)
+
+
+def c_literal(chars):
+    """chars and their terminating NUL in SEND_STRING syntax."""
+    out = []
+    literal = None
+    for char in chars:
+        if char.startswith('{'):
+            if literal is not None:
+                out.append(f'"{literal}"')
+                literal = None
+            out.append(f'SS_TAP(X_{char[1:-1]})')
+            continue
+        literal = (literal or '') + char
+        # A numeric escape would swallow the digits after it.
+        if re.match(r'\\(x|[0-7])', char):
+            out.append(f'"{literal}"')
+            literal = None
+    out.append(f'"{literal or ""}\\0"')
+    return ' '.join(out)
+
+
+class Pool:
+    """NUL-terminated strings, each either its own segment or a suffix of one."""
+
+    def __init__(self):
+        self.segments = []
+        self.size = 0
+
+    def place(self, chars):
+        offset = self.size
+        self.segments.append(chars)
+        self.size += chars_size(chars) + 1
+        return offset
+
+    def find(self, chars):
+        offset = 0
+        for segment in self.segments:
+            if segment[len(segment) - len(chars):] == chars:
+                return offset + chars_size(segment) - chars_size(chars)
+            offset += chars_size(segment) + 1
+        return None
+
+
+def build_pool(numbered):
+    """Sets each string's pool offset. A string with a different shifted form
+    is followed by it, and so gets its own segment; the rest share the tail of
+    a longer string where they can."""
+    pool = Pool()
+    for string in numbered:
+        if string.shifted and string.shifted != string.text:
+            string.offset = pool.place(string.text)
+            pool.place(string.shifted)
+    rest = [string for string in numbered if not (string.shifted and string.shifted != string.text)]
+    for string in sorted(rest, key=lambda string: chars_size(string.text), reverse=True):
+        string.offset = pool.find(string.text)
+        if string.offset is None:
+            string.offset = pool.place(string.text)
+    if pool.size > 0xFFFF:
+        raise SpecError('the string pool is over 64 KiB')
+    return pool
+
+
+def parse_value(tokens, strings):
+    """[NAME=]keycode|"text" [/ "shifted"] [raw] [caps] from the front of tokens."""
+    token = tokens.pop(0)
+    name = None
+    match = re.match(r'(\w+)=(".*")$', token)
+    if match:
+        name, token = match.groups()
+    if not token.startswith('"'):
+        if name:
+            raise SpecError(f'{name}= needs a string')
+        return token
+    shifted = None
+    if tokens and tokens[0] == '/':
+        tokens.pop(0)
+        if not tokens or not tokens[0].startswith('"'):
+            raise SpecError('/ needs a string')
+        shifted = spec_chars(tokens.pop(0))
+    flags = set()
+    while tokens and tokens[0] in ('raw', 'caps'):
+        flags.add(tokens.pop(0))
+    if token == '""':
+        if name or shifted or flags:
+            raise SpecError('"" types nothing and takes no name, shifted form or flags')
+        return 'KC_NO'
+    if 'raw' in flags and shifted:
+        raise SpecError('raw strings are typed as they are, without a shifted form')
+    return strings.add(MagicString(spec_chars(token), shifted, flags, None), name)
+
+
+def parse_prev(token):
+    """Keys from one previous key token: a keycode, a name, a range, a
+    context of typed keys like KC_T+KC_H as a tuple, or typed "text"."""
+    if token.startswith('"'):
+        return [TypedText(spec_chars(token))]
+    if '+' in token:
+        keys = tuple(token.split('+'))
+        for key in keys:
+            if key not in BASIC_KEYCODES:
+                raise SpecError(f'{key} in {token}: contexts are made of basic keycodes')
+        return [keys]
+    match = re.match(r'(KC_\w+)\.\.(KC_\w+)$', token)
+    if match:
+        first, last = match.groups()
+        if first not in BASIC_KEYCODES or last not in BASIC_KEYCODES:
+            raise SpecError(f'range {token} needs basic keycodes')
+        return ORDER[ORDER.index(first):ORDER.index(last) + 1]
+    return [token]
+
+
+def expansion(output, keys, strings):
+    """A copy of the string output that first backspaces over keys."""
+    if isinstance(output, str) and output in strings.names:
+        output = strings.names[output]
+    if not isinstance(output, MagicString):
+        raise SpecError('expansions type strings')
+    erase = ('\\b',) * len(keys)
+    shifted = output.shifted and erase + output.shifted
+    return strings.add(MagicString(erase + output.text, shifted, output.flags, output.next_ref))
+
+
+def parse(lines):
+    strings = Strings()
+    rules = {'*': [], '@': [], 'lead': []}
+    for number, line in enumerate(lines, 1):
+        tokens = TOKEN.findall(line)
+        comment = next((i for i, t in enumerate(tokens) if t.startswith('#')), len(tokens))
+        tokens = tokens[:comment]
+        if not tokens:
+            continue
+        try:
+            trigger = next((i for i, t in enumerate(tokens) if t[0] in '*@' or t == 'lead'), None)
+            if not trigger:
+                raise SpecError('expected <keys> *, @ or lead <output>')
+            prev = [key for token in tokens[:trigger] for key in parse_prev(token)]
+            kind, mods = tokens[trigger][0], tokens[trigger][1:]
+            if tokens[trigger] == 'lead':
+                kind, mods = 'lead', ''
+            if mods not in MODS or (kind != '*' and mods):
+                raise SpecError(f'unknown trigger {tokens[trigger]}')
+            rest = tokens[trigger + 1:]
+            if not rest:
+                raise SpecError('missing output')
+            output = parse_value(rest, strings)
+            if rest and rest[0] == '->':
+                rest.pop(0)
+                if not rest:
+                    raise SpecError('-> needs a value')
+                if not isinstance(output, MagicString):
+                    raise SpecError('-> follows strings only; after a keycode, use a context like KC_A+KC_O @')
+                if 'raw' in output.flags:
+                    raise SpecError('raw strings leave the repeat key alone')
+                output.next_ref = parse_value(rest, strings)
+            if rest:
+                raise SpecError(f'unexpected {rest[0]}')
+            if mods and any(isinstance(key, (tuple, TypedText)) for key in prev):
+                raise SpecError('contexts and expansions match with no mods besides shift, so take a plain *')
+            for key in prev:
+                if isinstance(key, TypedText) and kind != '*':
+                    raise SpecError(f'"{key.text}" expands with the magic key, *')
+                if kind == 'lead':
+                    if isinstance(key, str) and key in BASIC_KEYCODES:
+                        key = (key,)
+                    if not isinstance(key, tuple):
+                        raise SpecError('lead takes basic keycodes, like KC_W+KC_I')
+                    if len(key) > 5:
+                        raise SpecError('QMK leader sequences are at most 5 keys')
+                if isinstance(key, TypedText):
+                    rules[kind].append((key, MODS[mods], expansion(output, key.keys, strings), number))
+                    continue
+                rules[kind].append((key, MODS[mods] if kind == '*' else (0, 0), output, number))
+            if isinstance(output, MagicString) and output not in strings.names.values() and all(isinstance(key, TypedText) for key in prev):
+                # Only its copies are typed.
+                strings.entries.remove(output)
+        except SpecError as error:
+            raise SpecError(f'line {number}: {error}') from None
+    return strings, rules
+
+
+def prev_value(key, strings):
+    if key in KEYCODES:
+        return KEYCODES[key]
+    if key in strings.names:
+        return MAGIC_BASE + strings.names[key].index
+    raise SpecError(f'{key} is not a keycode magic_gen.py knows or a string name')
+
+
+def context_hash(keys):
+    value = 0
+    for key in keys:
+        value = (value * HASH_BASE + BASIC_KEYCODES[key]) & 0xFFFF
+    return value
+
+
+def context_table(name, entries, strings):
+    """An open-addressed hash table of contexts, at most half full, probed
+    linearly from the context's hash. Keys are stored newest first. Returns
+    the table and the spec line of each slot."""
+    size = 2
+    while size < 2 * len(entries):
+        size *= 2
+    slots = [None] * size
+    for keys, output, number in entries:
+        slot = context_hash(keys) & (size - 1)
+        while slots[slot] is not None:
+            slot = (slot + 1) & (size - 1)
+        slots[slot] = (keys, output, number)
+    out = [f'static const magic_context_t {name}[{size}] PROGMEM = {{']
+    for slot, entry in enumerate(slots):
+        if entry is not None:
+            keys, output, _ = entry
+            newest_first = ', '.join(reversed(keys))
+            out.append(f'    [{slot}] = {{{{{newest_first}}}, {strings.resolve(output, output)}}}, // {"+".join(keys)}')
+    out.append('};')
+    return out, [entry and entry[2] for entry in slots]
+
+
+def trie_table(name, entries, strings, typed_backwards=False):
+    """A trie of key sequences in one array, root first. Each node's children
+    are next to each other, sorted on their key, so a lookup binary searches
+    one run of nodes per key. Returns the table and the spec line of each
+    node."""
+    root = {'children': {}, 'output': None, 'path': ()}
+    for keys, output, number in entries:
+        node = root
+        for key in keys:
+            node = node['children'].setdefault(key, {'children': {}, 'output': None, 'path': node['path'] + (key,)})
+        if node['output'] is not None:
+            raise SpecError(f'line {number}: {"+".join(keys)} given twice')
+        node['output'] = output
+        node['number'] = number
+    nodes = [root]
+    for node in nodes:
+        node['first'] = len(nodes)
+        nodes.extend(node['children'][key] for key in sorted(node['children'], key=lambda key: KEYCODES[key]))
+    if len(nodes) > 0xFFFF:
+        raise SpecError(f'{name} is over 65535 nodes')
+    out = [f'static const magic_trie_t {name}[{len(nodes)}] PROGMEM = {{']
+    for node in nodes:
+        key = node['path'][-1] if node['path'] else '0'
+        output = strings.resolve(node['output'], 'KC_NO')
+        path = node['path'][::-1] if typed_backwards else node['path']
+        comment = '+'.join(path) or 'root'
+        out.append(f'    {{{key}, {len(node["children"])}, {node["first"]}, {output}}}, // {comment}')
+    out.append('};')
+    return out, [node.get('number') for node in nodes]
+
+
+def rule_ids(name, lines, rule_id):
+    """Rule of each entry of a table, for magic.c to count hits with."""
+    ids = ', '.join(str(rule_id[line]) if line else '0' for line in lines)
+    return [f'static const uint16_t {name}[{len(lines)}] PROGMEM = {{{ids}}};']
+
+
+def generate(spec_name, strings, rules):
+    numbered = strings.number()
+    out = [
+        f'// Generated by magic_gen.py from {spec_name}. Do not edit.',
+        '// Included once for the count, and again by magic.c with MAGIC_TABLES',
+        '// defined for the tables.',
+        '#ifndef MAGIC_STRING_COUNT',
+        f'#    define MAGIC_STRING_COUNT {len(numbered)}',
+        '#elif defined(MAGIC_TABLES)',
+    ]
+    used = set()
+    tables = {}
+    contexts = {}
+    expansions = []
+    for keys, _, output, _ in rules['lead']:
+        used.update(keys)
+    for kind, name in (('*', 'magic_alt'), ('@', 'magic_repeat')):
+        entries = []
+        contexts[name] = []
+        for key, (mask, value), output, number in rules[kind]:
+            if kind == '@' and not isinstance(output, MagicString) and output not in strings.names:
+                raise SpecError(f'line {number}: the repeat key can only type strings')
+            if isinstance(key, TypedText):
+                used.update(key.keys)
+                # Matched newest key first.
+                expansions.append((tuple(reversed(key.keys)), output, number))
+                continue
+            if isinstance(key, tuple):
+                used.update(key)
+                if key in (context for context, _, _ in contexts[name]):
+                    raise SpecError(f'line {number}: {"+".join(key)} {kind} given twice')
+                contexts[name].append((key, output, number))
+                continue
+            try:
+                order = prev_value(key, strings)
+            except SpecError as error:
+                raise SpecError(f'line {number}: {error}') from None
+            if key in KEYCODES:
+                used.add(key)
+            entries.append((order, key, mask, value, output, number))
+        if len(entries) > 255:
+            raise SpecError(f'more than 255 {kind} rules')
+        # Stable, so rules for the same key keep their order in the spec.
+        entries.sort(key=lambda entry: entry[0])
+        tables[name] = entries
+    context_size = max([2] + [len(key) for name in contexts for key, _, _ in contexts[name]])
+    history_size = max([context_size] + [len(keys) for keys, _, _ in expansions])
+    if history_size > 255:
+        raise SpecError('expansions are at most 255 keys')
+    out.insert(5, f'#    define MAGIC_CONTEXT_SIZE {context_size}')
+    out.insert(6, f'#    define MAGIC_HISTORY_SIZE {history_size}')
+    # Each line of magic and repeat rules is one rule for the typing stats.
+    lines = sorted({number for kind in ('*', '@') for *_, number in rules[kind]})
+    rule_id = {line: i for i, line in enumerate(lines)}
+    out.insert(7, f'#    define MAGIC_RULE_COUNT {len(lines)}')
+    ids = []
+    out.append(f'static_assert(MAGIC_HASH_BASE == {HASH_BASE}, "magic_gen.py hashes with a different base");')
+    for key in sorted(used, key=lambda key: KEYCODES[key]):
+        out.append(f'static_assert({key} == 0x{KEYCODES[key]:04X}, "magic_gen.py has the wrong value for {key}");')
+    out.append('')
+    pool = build_pool(numbered)
+    out.append('static const char magic_pool[] PROGMEM =')
+    for segment in pool.segments:
+        out.append(f'    {c_literal(segment)}')
+    out[-1] += ';'
+    out.append(f'static_assert(sizeof(magic_pool) == {pool.size + 1}, "magic_gen.py miscounted the string pool");')
+    out.append('')
+    out.append('static const magic_string_t magic_strings[MAGIC_STRING_COUNT] PROGMEM = {')
+    for string in numbered:
+        flags = sorted(f'MAGIC_{flag.upper()}' for flag in string.flags)
+        comment = '"%s"' % ''.join(string.text)
+        if string.shifted == string.text:
+            flags.append('MAGIC_SAME_SHIFTED')
+        elif string.shifted:
+            flags.append('MAGIC_SHIFTED')
+            comment += ' / "%s"' % ''.join(string.shifted)
+        next_keycode = strings.resolve(string.next_ref, 'KC_NO')
+        out.append(f'    {{{string.offset}, {next_keycode}, {" | ".join(flags) or "0"}}}, // {comment}')
+    out.append('};')
+    for name, entries in tables.items():
+        out.append('')
+        out.append(f'static const magic_rule_t {name}_rules[] PROGMEM = {{')
+        for _, key, mask, value, output, _ in entries:
+            prev = strings.resolve(key, key)
+            out.append(f'    {{{prev}, 0x{mask:02X}, 0x{value:02X}, {strings.resolve(output, output)}}},')
+        out.append('};')
+        ids += rule_ids(f'{name}_rule_ids', [entry[-1] for entry in entries], rule_id)
+    for name, entries in contexts.items():
+        out.append('')
+        table, numbers = context_table(f"{name}_contexts", entries, strings)
+        out.extend(table)
+        ids += rule_ids(f'{name}_context_ids', numbers, rule_id)
+    out.append('')
+    table, numbers = trie_table('magic_expansion_trie', expansions, strings, typed_backwards=True)
+    out.extend(table)
+    ids += rule_ids('magic_expansion_ids', numbers, rule_id)
+    out.append('')
+    out.append('#    ifdef LEADER_ENABLE')
+    out.extend(trie_table('magic_leader_trie', [(keys, output, number) for keys, _, output, number in rules['lead']], strings)[0])
+    out.append('#    endif')
+    out.append('')
+    out.append('#    ifdef TYPING_STATS_ENABLE')
+    out.append(f'static const uint16_t magic_rule_lines[MAGIC_RULE_COUNT] PROGMEM = {{{", ".join(map(str, lines))}}};')
+    out.extend(ids)
+    out.append('#    endif')
+    out.append('#endif')
+    return '\n'.join(out) + '\n'
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(f'usage: {sys.argv[0]} magic.rules magic_tables.h')
+    spec, header = sys.argv[1:]
+    try:
+        with open(spec) as f:
+            strings, rules = parse(f)
+        text = generate(spec.rsplit('/', 1)[-1], strings, rules)
+    except SpecError as error:
+        sys.exit(f'{spec}: {error}')
+    try:
+        with open(header) as f:
+            if f.read() == text:
+                return
+    except FileNotFoundError:
+        pass
+    with open(header, 'w') as f:
+        f.write(text)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,81 @@
+#include "matrix_stream.h"
+#include "matrix.h"
+#include "raw_hid_commands.h"
+#include "raw_hid_queue.h"
+#include "timer.h"
+#include "usb_descriptor.h"
+#include <assert.h>
+#include <string.h>
+
+#define ENTRY_HEADER 3
+#define ROW_BYTES (1 + sizeof(matrix_row_t))
+
+static_assert(2 + ENTRY_HEADER + MATRIX_ROWS * ROW_BYTES <= RAW_EPSIZE, "a full matrix snapshot must fit in one frame");
+
+static bool stream_enabled = false;
+static bool stream_snapshot = false;
+static uint8_t stream_flush_ms = 0;
+static uint8_t stream_seq = 0;
+static matrix_row_t stream_rows[MATRIX_ROWS];
+
+static uint8_t frame[RAW_EPSIZE];
+static uint8_t frame_length = 0;
+static uint16_t frame_time = 0; // timestamp of the oldest entry
+
+static void matrix_stream_flush(void) {
+    if (frame_length > 2) {
+        frame[0] = RAW_HID_CMD_MATRIX_STREAM;
+        frame[1] = stream_seq++;
+        raw_hid_queue_send(frame, RAW_EPSIZE);
+    }
+    memset(frame, 0, sizeof(frame));
+    frame_length = 2;
+}
+
+void matrix_stream_receive(uint8_t *data, uint8_t length) {
+    if (length >= 2 && data[1]) {
+        stream_enabled = true;
+        stream_snapshot = true;
+        stream_flush_ms = length >= 3 ? data[2] : 0;
+        memset(frame, 0, sizeof(frame));
+        frame_length = 2;
+    } else {
+        matrix_stream_flush();
+        stream_enabled = false;
+    }
+}
+
+void matrix_stream_task(void) {
+    if (!stream_enabled) {
+        return;
+    }
+    uint16_t now = timer_read();
+    uint8_t entry[ENTRY_HEADER + MATRIX_ROWS * ROW_BYTES];
+    uint8_t entry_length = ENTRY_HEADER;
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        matrix_row_t bits = matrix_get_row(row);
+        if (bits != stream_rows[row] || stream_snapshot) {
+            stream_rows[row] = bits;
+            entry[entry_length] = row;
+            memcpy(&entry[entry_length + 1], &bits, sizeof(bits));
+            entry_length += ROW_BYTES;
+        }
+    }
+    stream_snapshot = false;
+    if (entry_length > ENTRY_HEADER) {
+        entry[0] = now & 0xFF;
+        entry[1] = now >> 8;
+        entry[2] = (entry_length - ENTRY_HEADER) / ROW_BYTES;
+        if (frame_length + entry_length > RAW_EPSIZE) {
+            matrix_stream_flush();
+        }
+        if (frame_length == 2) {
+            frame_time = now;
+        }
+        memcpy(&frame[frame_length], entry, entry_length);
+        frame_length += entry_length;
+    }
+    if (frame_length > 2 && timer_elapsed(frame_time) >= stream_flush_ms) {
+        matrix_stream_flush();
+    }
+}
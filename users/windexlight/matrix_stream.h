@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Streams debounced matrix changes to the host at scan resolution. Off until
+// the host enables it:
+//     [0xC3, enable, flush_ms]
+// Each 0xB1 frame holds [0xB1, seq] followed by one or more scan entries:
+//     [timestamp lo, timestamp hi, count, count x (row, row bits...)]
+// padded with zeros, so a count of zero ends the frame. Sparse changes from
+// several scans share a frame; it is flushed once full or once its oldest
+// entry is flush_ms old. The first entry after enabling lists every row.
+
+// Handler for RAW_HID_CMD_MATRIX_STREAM_CONTROL.
+void matrix_stream_receive(uint8_t *data, uint8_t length);
+// Call once per scan from housekeeping_task_user.
+void matrix_stream_task(void);
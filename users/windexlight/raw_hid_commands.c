@@ -0,0 +1,90 @@
+#include "raw_hid_commands.h"
+#include "key_trace.h"
+#include "latency_stats.h"
+#include "matrix_stream.h"
+#include "progmem.h"
+#include "raw_hid.h"
+#include "raw_hid_queue.h"
+#include "runtime_rules.h"
+#include "shared_keys.h"
+#include "typing_stats.h"
+#include "usb_descriptor.h"
+
+static void raw_hid_query(uint8_t *data, uint8_t length);
+static void raw_hid_batch(uint8_t *data, uint8_t length);
+
+static const raw_hid_command_t PROGMEM raw_hid_commands[] = {
+    {RAW_HID_CMD_HEARTBEAT, 1, shared_keys_receive_heartbeat},
+    {RAW_HID_CMD_SHARED_KEYS, 5, shared_keys_receive_remote},
+    {RAW_HID_CMD_SHARED_KEYS_FRAME, SHARED_KEYS_FRAME_HEADER, shared_keys_receive_frame},
+    {RAW_HID_CMD_MATRIX_STREAM_CONTROL, 1, matrix_stream_receive},
+    {RAW_HID_CMD_QUERY, 1, raw_hid_query},
+    {RAW_HID_CMD_BATCH, 1, raw_hid_batch},
+    {RAW_HID_CMD_KEY_TRACE, 1, key_trace_drain},
+    {RAW_HID_CMD_LATENCY_STATS, 1, latency_stats_receive},
+#ifdef TYPING_STATS_ENABLE
+    {RAW_HID_CMD_TYPING_STATS, 1, typing_stats_receive},
+#endif
+#ifdef RUNTIME_RULES_ENABLE
+    {RAW_HID_CMD_RUNTIME_RULES, 3, runtime_rules_receive},
+#endif
+};
+
+__attribute__((weak)) const raw_hid_command_t raw_hid_commands_user[] = {};
+__attribute__((weak)) const uint8_t raw_hid_commands_user_count = 0;
+
+static bool raw_hid_lookup(const raw_hid_command_t *table, uint8_t count, uint8_t *data, uint8_t length) {
+    for (uint8_t i = 0; i < count; i++) {
+        if (pgm_read_byte(&table[i].command) == data[0]) {
+            if (length >= pgm_read_byte(&table[i].min_length)) {
+                ((raw_hid_handler_t)pgm_read_ptr(&table[i].handler))(data, length);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void raw_hid_dispatch(uint8_t *data, uint8_t length) {
+    if (length == 0) {
+        return;
+    }
+    if (!raw_hid_lookup(raw_hid_commands, sizeof(raw_hid_commands) / sizeof(raw_hid_commands[0]), data, length)) {
+        raw_hid_lookup(raw_hid_commands_user, raw_hid_commands_user_count, data, length);
+    }
+}
+
+void raw_hid_receive(uint8_t *data, uint8_t length) {
+    raw_hid_dispatch(data, length);
+}
+
+static void raw_hid_batch(uint8_t *data, uint8_t length) {
+    uint8_t offset = 1;
+    while (offset < length && data[offset] != 0) {
+        uint8_t size = data[offset++];
+        if (size > length - offset || data[offset] == RAW_HID_CMD_BATCH) {
+            return;
+        }
+        raw_hid_dispatch(&data[offset], size);
+        offset += size;
+    }
+}
+
+static void raw_hid_query(uint8_t *data, uint8_t length) {
+    uint8_t response[RAW_EPSIZE] = {
+        RAW_HID_CMD_QUERY,
+        RAW_HID_PROTOCOL_VERSION,
+        SHARED_KEYS_DEVICE_ID,
+        SHARED_KEYS_PROTOCOL_VERSION,
+    };
+    uint8_t count = 0;
+    uint8_t *ids = &response[5];
+    for (uint8_t i = 0; i < sizeof(raw_hid_commands) / sizeof(raw_hid_commands[0]) && count < RAW_EPSIZE - 5; i++) {
+        ids[count++] = pgm_read_byte(&raw_hid_commands[i].command);
+    }
+    for (uint8_t i = 0; i < raw_hid_commands_user_count && count < RAW_EPSIZE - 5; i++) {
+        ids[count++] = pgm_read_byte(&raw_hid_commands_user[i].command);
+    }
+    response[4] = count;
+    raw_hid_queue_send(response, RAW_EPSIZE);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Raw HID command protocol shared by all windexlight keyboards. The first byte
+// of every message is its command. Host-to-device messages are looked up in
+// the common handler table, then in the keymap's raw_hid_commands_user[].
+
+#define RAW_HID_PROTOCOL_VERSION 1
+
+enum raw_hid_command_ids {
+    // Device to host.
+    RAW_HID_CMD_MIRROR_EXTENDED = 0xB0,
+    RAW_HID_CMD_MATRIX_STREAM = 0xB1,
+
+    // Host-processing mode, Cantor only.
+    RAW_HID_CMD_REPORT_ACK = 0xBD,
+    RAW_HID_CMD_HOST_MODE_ON = 0xBE,
+    RAW_HID_CMD_HOST_MODE_OFF = 0xBF,
+
+    // Shared keys. 0xC0 from a device is its legacy shared-key snapshot.
+    RAW_HID_CMD_HEARTBEAT = 0xC0,
+    RAW_HID_CMD_SHARED_KEYS = 0xC1,
+    RAW_HID_CMD_SHARED_KEYS_FRAME = 0xC2,
+
+    RAW_HID_CMD_MATRIX_STREAM_CONTROL = 0xC3,
+
+    // [0xC4] -> [0xC4, protocol version, device id, shared keys version, count, command ids...]
+    RAW_HID_CMD_QUERY = 0xC4,
+    // [0xC5, length, message..., length, message..., 0]; length counts the
+    // message's command byte. Packs several small messages into one packet.
+    RAW_HID_CMD_BATCH = 0xC5,
+    // See key_trace.h.
+    RAW_HID_CMD_KEY_TRACE = 0xC6,
+    // See latency_stats.h.
+    RAW_HID_CMD_LATENCY_STATS = 0xC7,
+    // See typing_stats.h; only with TYPING_STATS_ENABLE.
+    RAW_HID_CMD_TYPING_STATS = 0xC8,
+    // See runtime_rules.h; only with RUNTIME_RULES_ENABLE.
+    RAW_HID_CMD_RUNTIME_RULES = 0xC9,
+};
+
+// Handlers see only their own message, and are not called for messages
+// shorter than min_length.
+typedef void (*raw_hid_handler_t)(uint8_t *data, uint8_t length);
+
+typedef struct {
+    uint8_t           command;
+    uint8_t           min_length;
+    raw_hid_handler_t handler;
+} raw_hid_command_t;
+
+// Keymap-specific commands, optional.
+extern const raw_hid_command_t raw_hid_commands_user[];
+extern const uint8_t           raw_hid_commands_user_count;
+
+void raw_hid_dispatch(uint8_t *data, uint8_t length);
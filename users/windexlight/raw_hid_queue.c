@@ -0,0 +1,86 @@
+#include "raw_hid_queue.h"
+#include "latency_stats.h"
+#include "raw_hid.h"
+#include "usb_descriptor.h"
+#include <assert.h>
+#include <string.h>
+
+#ifdef PROTOCOL_CHIBIOS
+#    include <hal.h>
+#    include "usb_main.h"
+#endif
+
+static_assert((RAW_HID_QUEUE_SIZE & (RAW_HID_QUEUE_SIZE - 1)) == 0 && RAW_HID_QUEUE_SIZE <= 128, "RAW_HID_QUEUE_SIZE must be a power of two, at most 128");
+
+// Single producer, single consumer. Only the producer writes head and only the
+// consumer writes tail. The free-running indices are masked on access so a
+// full queue is distinguishable from an empty one.
+static uint8_t queue[RAW_HID_QUEUE_SIZE][RAW_EPSIZE];
+static uint8_t queue_head = 0;
+static uint8_t queue_tail = 0;
+static raw_hid_queue_stats_t queue_stats = {0};
+
+#ifdef PROTOCOL_CHIBIOS
+__attribute__((weak)) bool raw_hid_queue_endpoint_ready(void) {
+    osalSysLock();
+    bool ready = usbGetDriverStateI(&USB_DRIVER) == USB_ACTIVE && !usbGetTransmitStatusI(&USB_DRIVER, RAW_IN_EPNUM);
+    osalSysUnlock();
+    return ready;
+}
+#else
+__attribute__((weak)) bool raw_hid_queue_endpoint_ready(void) {
+    return true;
+}
+#endif
+
+uint8_t raw_hid_queue_depth(void) {
+    return (uint8_t)(__atomic_load_n(&queue_head, __ATOMIC_ACQUIRE) - __atomic_load_n(&queue_tail, __ATOMIC_ACQUIRE));
+}
+
+static void raw_hid_queue_send_oldest(void) {
+    uint8_t tail = queue_tail;
+    uint32_t start = latency_stats_now();
+    raw_hid_send(queue[tail % RAW_HID_QUEUE_SIZE], RAW_EPSIZE);
+    latency_stats_add(LATENCY_RAW_HID_SEND, latency_stats_now() - start);
+    __atomic_store_n(&queue_tail, (uint8_t)(tail + 1), __ATOMIC_RELEASE);
+}
+
+bool raw_hid_queue_send(const uint8_t *data, uint8_t length) {
+    uint8_t head = queue_head;
+    uint8_t depth = (uint8_t)(head - __atomic_load_n(&queue_tail, __ATOMIC_ACQUIRE));
+    if (depth >= RAW_HID_QUEUE_SIZE) {
+        if (queue_stats.dropped < UINT16_MAX) {
+            queue_stats.dropped++;
+        }
+        return false;
+    }
+    uint8_t *frame = queue[head % RAW_HID_QUEUE_SIZE];
+    if (length > RAW_EPSIZE) {
+        length = RAW_EPSIZE;
+    }
+    memcpy(frame, data, length);
+    memset(frame + length, 0, RAW_EPSIZE - length);
+    __atomic_store_n(&queue_head, (uint8_t)(head + 1), __ATOMIC_RELEASE);
+    if (depth + 1 > queue_stats.high_water) {
+        queue_stats.high_water = depth + 1;
+    }
+    return true;
+}
+
+void raw_hid_queue_task(void) {
+    for (uint8_t i = 0; i < RAW_HID_QUEUE_DRAIN_MAX; i++) {
+        if (raw_hid_queue_depth() == 0 || !raw_hid_queue_endpoint_ready()) {
+            return;
+        }
+        raw_hid_queue_send_oldest();
+    }
+}
+
+const raw_hid_queue_stats_t *raw_hid_queue_stats(void) {
+    return &queue_stats;
+}
+
+void raw_hid_queue_stats_reset(void) {
+    queue_stats.dropped = 0;
+    queue_stats.high_water = raw_hid_queue_depth();
+}
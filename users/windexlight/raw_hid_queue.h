@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Outgoing raw HID frames are queued here and sent from housekeeping, so a slow
+// host never stalls the code path that produced them, the HID report
+// interposers in particular.
+
+#ifndef RAW_HID_QUEUE_SIZE
+#    define RAW_HID_QUEUE_SIZE 32 // power of two, a magic string burst must fit
+#endif
+
+// Frames sent per raw_hid_queue_task() call, bounds time spent per scan.
+#ifndef RAW_HID_QUEUE_DRAIN_MAX
+#    define RAW_HID_QUEUE_DRAIN_MAX 2
+#endif
+
+typedef struct {
+    uint16_t dropped;    // frames that found the queue full
+    uint8_t  high_water; // deepest the queue has been
+} raw_hid_queue_stats_t;
+
+// Copies the frame, zero-padded to RAW_EPSIZE. If the queue is full the frame
+// is dropped and counted, so the caller never waits on the host, and false is
+// returned.
+bool raw_hid_queue_send(const uint8_t *data, uint8_t length);
+void raw_hid_queue_task(void);
+uint8_t raw_hid_queue_depth(void);
+const raw_hid_queue_stats_t *raw_hid_queue_stats(void);
+void raw_hid_queue_stats_reset(void);
+
+// False while raw_hid_send would wait for the IN endpoint. On ChibiOS that is
+// while USB is down or a transfer is under way; weak, for other platforms.
+bool raw_hid_queue_endpoint_ready(void);
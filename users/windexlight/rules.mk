@@ -0,0 +1,30 @@
+SRC += shared_keys.c
+SRC += raw_hid_queue.c
+SRC += matrix_stream.c
+SRC += raw_hid_commands.c
+SRC += key_trace.c
+SRC += latency_stats.c
+SRC += macro_player.c
+
+# Typing statistics over raw HID, for keymaps that set TYPING_STATS_ENABLE = yes.
+ifeq ($(strip $(TYPING_STATS_ENABLE)), yes)
+    SRC += typing_stats.c
+    OPT_DEFS += -DTYPING_STATS_ENABLE
+endif
+
+# Alt repeat rules and key overrides written over raw HID, for keymaps that set
+# RUNTIME_RULES_ENABLE = yes and size EECONFIG_USER_DATA_SIZE for them.
+ifeq ($(strip $(RUNTIME_RULES_ENABLE)), yes)
+    SRC += runtime_rules.c
+    OPT_DEFS += -DRUNTIME_RULES_ENABLE
+endif
+
+# A keymap with magic key rules sets MAGIC_RULES to them. magic_tables.h is
+# generated next to the rules on every build, and only rewritten on a change.
+ifdef MAGIC_RULES
+    SRC += magic.c
+    MAGIC_GEN := $(shell python3 $(dir $(lastword $(MAKEFILE_LIST)))magic_gen.py $(MAGIC_RULES) $(dir $(MAGIC_RULES))magic_tables.h && echo ok)
+    ifneq ($(MAGIC_GEN),ok)
+        $(error magic_gen.py failed on $(MAGIC_RULES))
+    endif
+endif
@@ -0,0 +1,166 @@
+#include "runtime_rules.h"
+#include "quantum.h"
+#include "eeconfig.h"
+#include "raw_hid_commands.h"
+#include "raw_hid_queue.h"
+#include "usb_descriptor.h"
+#include <assert.h>
+#include <string.h>
+
+static_assert(sizeof(runtime_rule_t) == 6, "runtime_rule_t is sent as it is");
+static_assert(RUNTIME_RULES_MAX <= 255, "rules are counted in a byte");
+static_assert(EECONFIG_USER_DATA_SIZE >= RUNTIME_RULES_EEPROM_SIZE, "EECONFIG_USER_DATA_SIZE must cover RUNTIME_RULES_EEPROM_SIZE");
+static_assert(RUNTIME_RULES_FRAME_HEADER + RUNTIME_RULES_PER_FRAME * sizeof(runtime_rule_t) <= RAW_EPSIZE, "a frame of rules fits a report");
+
+// As saved in EEPROM. The rules double as the staging area for the host.
+static struct __attribute__((packed)) {
+    runtime_rules_header_t header;
+    runtime_rule_t         rules[RUNTIME_RULES_MAX];
+} block;
+
+// The saved alt repeat rules, sorted on keycode, with mods folded to the left
+// side so either side matches.
+static runtime_rule_t alt_rules[RUNTIME_RULES_MAX];
+static uint8_t        alt_count = 0;
+
+static uint8_t mods_either_side(uint8_t mods) {
+    return (mods | mods >> 4) & 0x0F;
+}
+
+static uint16_t checksum(uint8_t count) {
+    const uint8_t *bytes = (const uint8_t *)block.rules;
+    uint16_t       sum   = 0;
+    for (uint16_t i = 0; i < count * sizeof(runtime_rule_t); i++) {
+        sum += bytes[i];
+    }
+    return sum;
+}
+
+#ifdef KEY_OVERRIDE_ENABLE
+// Ahead of the keymap's key_overrides[], which QMK tries in order.
+static key_override_t overrides[RUNTIME_RULES_MAX];
+static uint8_t        override_count = 0;
+
+uint16_t key_override_count(void) {
+    return override_count + key_override_count_raw();
+}
+
+const key_override_t *key_override_get(uint16_t key_override_idx) {
+    return key_override_idx < override_count ? &overrides[key_override_idx] : key_override_get_raw(key_override_idx - override_count);
+}
+#endif
+
+// Makes the first count rules of the block live.
+static void rules_apply(uint8_t count) {
+    alt_count = 0;
+#ifdef KEY_OVERRIDE_ENABLE
+    override_count = 0;
+#endif
+    for (uint8_t i = 0; i < count; i++) {
+        runtime_rule_t rule = block.rules[i];
+        if (rule.kind == RUNTIME_RULE_ALT_REPEAT) {
+            // Insertion sort, keeping rules for the same key in their order.
+            uint8_t j = alt_count++;
+            for (; j > 0 && alt_rules[j - 1].keycode > rule.keycode; j--) {
+                alt_rules[j] = alt_rules[j - 1];
+            }
+            rule.mods    = mods_either_side(rule.mods);
+            alt_rules[j] = rule;
+        }
+#ifdef KEY_OVERRIDE_ENABLE
+        else if (rule.kind == RUNTIME_RULE_KEY_OVERRIDE) {
+            key_override_t *override = &overrides[override_count++];
+            if (rule.output == KC_TRNS) {
+                *override                 = ko_make_basic(rule.mods, rule.keycode, rule.keycode);
+                override->suppressed_mods = 0;
+            } else {
+                *override = ko_make_basic(rule.mods, rule.keycode, rule.output);
+            }
+        }
+#endif
+    }
+}
+
+void runtime_rules_init(void) {
+    eeconfig_read_user_datablock(&block, 0, sizeof(block));
+    if (block.header.format != RUNTIME_RULES_FORMAT || block.header.count > RUNTIME_RULES_MAX || block.header.checksum != checksum(block.header.count)) {
+        memset(&block, 0, sizeof(block));
+    }
+    rules_apply(block.header.count);
+}
+
+uint16_t runtime_rules_alt_repeat_keycode(uint16_t keycode, uint8_t mods) {
+    if (alt_count == 0) {
+        return KC_TRNS;
+    }
+    keycode = get_tap_keycode(keycode);
+    mods    = mods_either_side(mods);
+    // The first rule for keycode, then each rule for it in turn.
+    uint8_t low = 0, high = alt_count;
+    while (low < high) {
+        uint8_t middle = (low + high) / 2;
+        if (alt_rules[middle].keycode < keycode) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    for (; low < alt_count && alt_rules[low].keycode == keycode; low++) {
+        if (alt_rules[low].mods == mods) {
+            return alt_rules[low].output;
+        }
+    }
+    return KC_TRNS;
+}
+
+static bool rules_save(uint8_t count) {
+    if (count > RUNTIME_RULES_MAX) {
+        return false;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        if (block.rules[i].kind != RUNTIME_RULE_ALT_REPEAT && block.rules[i].kind != RUNTIME_RULE_KEY_OVERRIDE) {
+            return false;
+        }
+    }
+    block.header = (runtime_rules_header_t){.format = RUNTIME_RULES_FORMAT, .count = count, .checksum = checksum(count)};
+    eeconfig_update_user_datablock(&block, 0, sizeof(block.header) + count * sizeof(runtime_rule_t));
+    rules_apply(count);
+    return true;
+}
+
+void runtime_rules_receive(uint8_t *data, uint8_t length) {
+    uint8_t reply[RAW_EPSIZE] = {RAW_HID_CMD_RUNTIME_RULES, data[1]};
+    switch (data[1]) {
+        case RUNTIME_RULES_READ: {
+            uint8_t index = data[2];
+            uint8_t n     = 0;
+            if (length >= 3 && index < RUNTIME_RULES_MAX) {
+                n = RUNTIME_RULES_MAX - index < RUNTIME_RULES_PER_FRAME ? RUNTIME_RULES_MAX - index : RUNTIME_RULES_PER_FRAME;
+                memcpy(&reply[RUNTIME_RULES_FRAME_HEADER], &block.rules[index], n * sizeof(runtime_rule_t));
+            }
+            reply[2] = index;
+            reply[3] = n;
+            reply[4] = block.header.count;
+            raw_hid_queue_send(reply, RAW_EPSIZE);
+            break;
+        }
+        case RUNTIME_RULES_STAGE: {
+            // A short message, such as one inside a 0xC5 batch, stages nothing
+            // rather than rules from the bytes after it.
+            uint8_t index = data[2];
+            uint8_t n     = length >= 4 ? data[3] : 0;
+            reply[2]      = index;
+            reply[3]      = n;
+            reply[4]      = length >= 4 && n <= RUNTIME_RULES_PER_FRAME && index <= RUNTIME_RULES_MAX - n && length >= RUNTIME_RULES_FRAME_HEADER + n * sizeof(runtime_rule_t);
+            if (reply[4]) {
+                memcpy(&block.rules[index], &data[RUNTIME_RULES_FRAME_HEADER], n * sizeof(runtime_rule_t));
+            }
+            raw_hid_queue_send(reply, RAW_EPSIZE);
+            break;
+        }
+        case RUNTIME_RULES_SAVE:
+            reply[2] = length >= 3 && rules_save(data[2]);
+            raw_hid_queue_send(reply, RAW_EPSIZE);
+            break;
+    }
+}
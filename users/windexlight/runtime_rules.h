@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Alt repeat rules and key overrides that can be changed without reflashing,
+// built with RUNTIME_RULES_ENABLE = yes. The host writes them over raw HID to
+// the EEPROM user datablock, and they are copied to RAM at boot and after every
+// save. They come ahead of the compiled-in ones: an alt repeat rule ahead of
+// magic.rules, a key override ahead of key_overrides[].
+//
+// The host stages rules in RAM and then saves them, so a partly written set is
+// never live:
+//     [0xC9, 0, index]                 -> [0xC9, 0, index, n, count, n rules from index]
+//     [0xC9, 1, index, n, 0, n rules]  -> [0xC9, 1, index, n, ok]; stages n rules from index
+//     [0xC9, 2, count]                 -> [0xC9, 2, ok]; saves the first count staged rules
+// count is the number of saved rules. Reads see the staged rules, which start
+// as the saved ones, up to 4 a frame and none past RUNTIME_RULES_MAX. Saving 0
+// rules clears them. A stage message too short for its n rules stages none.
+
+#ifndef RUNTIME_RULES_MAX
+#    define RUNTIME_RULES_MAX 32
+#endif
+
+enum runtime_rule_kind {
+    RUNTIME_RULE_ALT_REPEAT = 1,
+    RUNTIME_RULE_KEY_OVERRIDE,
+};
+
+// Little-endian on the wire and in EEPROM. mods are 8-bit, as get_mods()
+// returns them, with both bits of a mod set for either side.
+// - RUNTIME_RULE_ALT_REPEAT: keycode is the previous key, as its tap keycode,
+//   and matches when its mods are exactly these. output is what the magic key
+//   sends: KC_NO turns a compiled rule off.
+// - RUNTIME_RULE_KEY_OVERRIDE: keycode with the trigger mods held sends output
+//   instead, on every layer. An output of KC_TRNS sends the key unchanged,
+//   which turns a compiled override off.
+typedef struct __attribute__((packed)) {
+    uint8_t  kind;
+    uint8_t  mods;
+    uint16_t keycode;
+    uint16_t output;
+} runtime_rule_t;
+
+#define RUNTIME_RULES_READ 0
+#define RUNTIME_RULES_STAGE 1
+#define RUNTIME_RULES_SAVE 2
+
+#define RUNTIME_RULES_FRAME_HEADER 5
+#define RUNTIME_RULES_PER_FRAME 4
+
+// Format of the saved rules; EEPROM holding anything else has no rules.
+#define RUNTIME_RULES_FORMAT 1
+
+typedef struct __attribute__((packed)) {
+    uint8_t  format;
+    uint8_t  count;
+    uint16_t checksum; // sum of the rule bytes
+} runtime_rules_header_t;
+
+// EECONFIG_USER_DATA_SIZE must cover this.
+#define RUNTIME_RULES_EEPROM_SIZE (sizeof(runtime_rules_header_t) + RUNTIME_RULES_MAX * sizeof(runtime_rule_t))
+
+// Call from keyboard_post_init_user.
+void runtime_rules_init(void);
+// Ahead of the compiled rules in get_alt_repeat_key_keycode_user; KC_TRNS when
+// no rule matches.
+uint16_t runtime_rules_alt_repeat_keycode(uint16_t keycode, uint8_t mods);
+// Handler for RAW_HID_CMD_RUNTIME_RULES.
+void runtime_rules_receive(uint8_t *data, uint8_t length);
@@ -0,0 +1,234 @@
+#include "shared_keys.h"
+#include "raw_hid_commands.h"
+#include "raw_hid_queue.h"
+#include "timer.h"
+#include "usb_descriptor.h"
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+static_assert(sizeof(shared_keys_frame_t) <= RAW_EPSIZE, "shared_keys_frame_t does not fit in a raw HID report");
+static_assert(offsetof(shared_keys_frame_t, data) == SHARED_KEYS_FRAME_HEADER, "SHARED_KEYS_FRAME_HEADER must match shared_keys_frame_t");
+static_assert(SHARED_KEYS_COUNT % 32 == 0 && SHARED_KEYS_COUNT <= 256, "SHARED_KEYS_COUNT must be a multiple of 32, at most 256");
+
+#define SHARED_KEYS_BYTES (SHARED_KEYS_COUNT / 8)
+
+static uint32_t shared_keys_local[SHARED_KEYS_WORDS] = {0};
+static uint32_t shared_keys_remote[SHARED_KEYS_WORDS] = {0};
+static uint32_t shared_keys_sent[SHARED_KEYS_WORDS] = {0};
+static uint8_t raw_hid_report[RAW_EPSIZE];
+
+static uint32_t last_heartbeat_time = 0;
+static uint16_t heartbeat_timeout = HEARTBEAT_TIMEOUT_MS;
+static uint8_t host_version = 0;
+
+// Transmit side of the versioned protocol.
+static uint16_t tx_seq = 0;
+static bool tx_synced = false;
+static bool tx_snapshot = false; // peer asked for a full snapshot
+static bool tx_force = false;    // send a frame even if nothing changed
+
+// Receive side, tracking the last frame accepted from the peer.
+static bool rx_valid = false;
+static bool rx_resync = false;
+static uint8_t rx_sender = 0;
+static uint16_t rx_seq = 0;
+
+__attribute__((weak)) void shared_key_event(uint8_t key, bool pressed) {}
+
+static uint8_t get_byte(const uint32_t *keys, uint8_t i) {
+    return keys[i / 4] >> ((i % 4) * 8);
+}
+
+static void set_byte(uint32_t *keys, uint8_t i, uint8_t value) {
+    uint8_t shift = (i % 4) * 8;
+    keys[i / 4] = (keys[i / 4] & ~((uint32_t)0xFF << shift)) | ((uint32_t)value << shift);
+}
+
+// Only bits that actually changed are visited, and only those not masked by the
+// local side, since a key held locally stays down regardless of the remote.
+void process_shared_keys_remote(const uint32_t keys[SHARED_KEYS_WORDS]) {
+    for (uint8_t w = 0; w < SHARED_KEYS_WORDS; w++) {
+        uint32_t changed = (keys[w] ^ shared_keys_remote[w]) & ~shared_keys_local[w];
+        shared_keys_remote[w] = keys[w];
+        while (changed) {
+            uint8_t bit = __builtin_ctz(changed);
+            changed &= changed - 1;
+            shared_key_event(w * 32 + bit, (keys[w] >> bit) & 1);
+        }
+    }
+}
+
+void shared_key_event_local(uint8_t key, bool pressed) {
+#if SHARED_KEYS_COUNT < 256
+    if (key >= SHARED_KEYS_COUNT) {
+        return;
+    }
+#endif
+    uint8_t w = key / 32;
+    uint32_t bit = (uint32_t)1 << (key % 32);
+    uint32_t keys = pressed ? (shared_keys_local[w] | bit) : (shared_keys_local[w] & ~bit);
+    if (keys != shared_keys_local[w]) {
+        if (!(shared_keys_remote[w] & bit)) {
+            shared_key_event(key, pressed);
+        }
+        shared_keys_local[w] = keys;
+    }
+}
+
+bool shared_keys_host_connected(void) {
+    return timer_elapsed32(last_heartbeat_time) <= heartbeat_timeout;
+}
+
+void shared_keys_set_heartbeat_timeout(uint16_t timeout_ms) {
+    heartbeat_timeout = timeout_ms ? timeout_ms : HEARTBEAT_TIMEOUT_MS;
+}
+
+// Local changes are only buffered above, so a chord that changes several shared
+// keys during one scan goes out as a single packet. Transitions that cancel out
+// within the scan never hit the wire.
+void shared_keys_task(void) {
+    if (!shared_keys_host_connected()) {
+        // Start the next session from a clean slate on both ends.
+        static const uint32_t released[SHARED_KEYS_WORDS] = {0};
+        host_version = 0;
+        heartbeat_timeout = HEARTBEAT_TIMEOUT_MS;
+        tx_synced = false;
+        rx_valid = false;
+        process_shared_keys_remote(released);
+    }
+    if (tx_force || memcmp(shared_keys_local, shared_keys_sent, sizeof(shared_keys_local)) != 0) {
+        shared_keys_send();
+    }
+}
+
+static void shared_keys_send_frame(uint8_t flags) {
+    shared_keys_frame_t *frame = (shared_keys_frame_t *)raw_hid_report;
+    frame->command = RAW_HID_CMD_SHARED_KEYS_FRAME;
+    frame->version = SHARED_KEYS_PROTOCOL_VERSION;
+    frame->sender = SHARED_KEYS_DEVICE_ID;
+    frame->flags = flags | (rx_resync ? SHARED_KEYS_FRAME_RESYNC : 0);
+    frame->seq = tx_seq++;
+    frame->timestamp = timer_read32();
+    raw_hid_queue_send(raw_hid_report, RAW_EPSIZE);
+}
+
+// Sends the toggled keys as a sparse list of indices when they fit in a single
+// frame, and the bitmap otherwise.
+static void shared_keys_send_frames(void) {
+    shared_keys_frame_t *frame = (shared_keys_frame_t *)raw_hid_report;
+    uint8_t flags = tx_synced ? 0 : SHARED_KEYS_FRAME_SYNC;
+    if (tx_synced && !tx_snapshot) {
+        uint8_t count = 0;
+        for (uint8_t w = 0; w < SHARED_KEYS_WORDS; w++) {
+            count += __builtin_popcount(shared_keys_local[w] ^ shared_keys_sent[w]);
+        }
+        if (count <= SHARED_KEYS_FRAME_DATA) {
+            frame->count = 0;
+            for (uint8_t w = 0; w < SHARED_KEYS_WORDS; w++) {
+                uint32_t toggled = shared_keys_local[w] ^ shared_keys_sent[w];
+                while (toggled) {
+                    frame->data[frame->count++] = w * 32 + __builtin_ctz(toggled);
+                    toggled &= toggled - 1;
+                }
+            }
+            shared_keys_send_frame(SHARED_KEYS_FRAME_DELTA);
+            return;
+        }
+    }
+    for (uint8_t offset = 0; offset < SHARED_KEYS_BYTES; offset += SHARED_KEYS_FRAME_DATA) {
+        memset(raw_hid_report, 0, sizeof(raw_hid_report));
+        frame->offset = offset;
+        frame->count = SHARED_KEYS_BYTES - offset < SHARED_KEYS_FRAME_DATA ? SHARED_KEYS_BYTES - offset : SHARED_KEYS_FRAME_DATA;
+        for (uint8_t i = 0; i < frame->count; i++) {
+            frame->data[i] = get_byte(shared_keys_local, offset + i);
+        }
+        shared_keys_send_frame(flags);
+        flags = 0;
+    }
+    tx_synced = true;
+    tx_snapshot = false;
+}
+
+void shared_keys_send(void) {
+    memset(raw_hid_report, 0, sizeof(raw_hid_report));
+    if (host_version >= SHARED_KEYS_PROTOCOL_VERSION) {
+        shared_keys_send_frames();
+    } else {
+        raw_hid_report[0] = RAW_HID_CMD_HEARTBEAT;
+        raw_hid_report[1] = shared_keys_local[0] & 0xFF;
+        raw_hid_report[2] = (shared_keys_local[0] >> 8) & 0xFF;
+        raw_hid_report[3] = (shared_keys_local[0] >> 16) & 0xFF;
+        raw_hid_report[4] = (shared_keys_local[0] >> 24) & 0xFF;
+        raw_hid_queue_send(raw_hid_report, RAW_EPSIZE);
+    }
+    memcpy(shared_keys_sent, shared_keys_local, sizeof(shared_keys_sent));
+    tx_force = false;
+}
+
+// Sequence numbers are compared with wraparound, anything at or behind the last
+// accepted frame is stale and dropped. A delta is only usable directly after the
+// frame it was built on, otherwise the peer is asked for a snapshot. A frame
+// cut short before its count bytes of data is dropped whole.
+void shared_keys_receive_frame(uint8_t *data, uint8_t length) {
+    const shared_keys_frame_t *frame = (const shared_keys_frame_t *)data;
+    uint8_t count = frame->count < SHARED_KEYS_FRAME_DATA ? frame->count : SHARED_KEYS_FRAME_DATA;
+    if (length < SHARED_KEYS_FRAME_HEADER + count || frame->version != SHARED_KEYS_PROTOCOL_VERSION || frame->sender == SHARED_KEYS_DEVICE_ID) {
+        return;
+    }
+    if (frame->flags & SHARED_KEYS_FRAME_RESYNC) {
+        tx_snapshot = true;
+        tx_force = true;
+    }
+    bool delta = frame->flags & SHARED_KEYS_FRAME_DELTA;
+    if (!(frame->flags & SHARED_KEYS_FRAME_SYNC)) {
+        bool in_sequence = rx_valid && frame->sender == rx_sender;
+        int16_t ahead = (int16_t)(frame->seq - rx_seq);
+        if (in_sequence && ahead <= 0) {
+            return;
+        }
+        if (delta && (!in_sequence || ahead != 1)) {
+            rx_valid = false;
+            if (!rx_resync) {
+                rx_resync = true;
+                tx_force = true;
+            }
+            return;
+        }
+    }
+    rx_valid = true;
+    rx_resync = false;
+    rx_sender = frame->sender;
+    rx_seq = frame->seq;
+
+    uint32_t keys[SHARED_KEYS_WORDS];
+    memcpy(keys, shared_keys_remote, sizeof(keys));
+    for (uint8_t i = 0; i < count; i++) {
+        if (delta) {
+            uint8_t key = frame->data[i];
+            if (key / 32 < SHARED_KEYS_WORDS) {
+                keys[key / 32] ^= (uint32_t)1 << (key % 32);
+            }
+        } else if (frame->offset + i < SHARED_KEYS_BYTES) {
+            set_byte(keys, frame->offset + i, frame->data[i]);
+        }
+    }
+    process_shared_keys_remote(keys);
+}
+
+void shared_keys_receive_heartbeat(uint8_t *data, uint8_t length) {
+    last_heartbeat_time = timer_read32();
+    host_version = length >= 2 ? data[1] : 0;
+    if (host_version >= SHARED_KEYS_PROTOCOL_VERSION && !tx_synced) {
+        tx_force = true; // announce our state to the peer
+    }
+}
+
+// A legacy snapshot only covers the first 32 keys. The rest keep the state a
+// versioned peer gave them.
+void shared_keys_receive_remote(uint8_t *data, uint8_t length) {
+    uint32_t keys[SHARED_KEYS_WORDS];
+    memcpy(keys, shared_keys_remote, sizeof(keys));
+    keys[0] = data[1] | (data[2] << 8) | ((uint32_t)data[3] << 16) | ((uint32_t)data[4] << 24);
+    process_shared_keys_remote(keys);
+}
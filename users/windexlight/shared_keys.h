@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Shared keys are virtual keys whose state is relayed between devices by a
+// host process. Each device tracks the keys it holds locally and the keys the
+// other device reports; a shared key is down while either side holds it.
+
+// Size of the shared-key space, a multiple of 32 up to 256. Set per keymap in
+// config.h; both devices must agree.
+#ifndef SHARED_KEYS_COUNT
+#    define SHARED_KEYS_COUNT 32
+#endif
+#define SHARED_KEYS_WORDS (SHARED_KEYS_COUNT / 32)
+
+#ifndef HEARTBEAT_TIMEOUT_MS
+#    define HEARTBEAT_TIMEOUT_MS 2000
+#endif
+
+// Identifies this device in versioned frames, set per keymap in config.h.
+#ifndef SHARED_KEYS_DEVICE_ID
+#    define SHARED_KEYS_DEVICE_ID 0
+#endif
+
+#define SHARED_KEYS_PROTOCOL_VERSION 2
+
+// Raw HID commands, see raw_hid_commands.h. 0xC0 from the host is a heartbeat
+// whose second byte is the protocol version the relay speaks (zero padding from
+// legacy relays). 0xC0 from a device and 0xC1 from the host carry a bare
+// little-endian snapshot of the first 32 shared keys, which leaves the others
+// as they were. 0xC2 is a frame.
+
+// Frame flags.
+#define SHARED_KEYS_FRAME_DELTA 0x01  // data lists the keys toggled since seq - 1
+#define SHARED_KEYS_FRAME_SYNC 0x02   // first frame of a session, resets the receiver
+#define SHARED_KEYS_FRAME_RESYNC 0x04 // sender missed a delta, peer should send a snapshot
+
+#define SHARED_KEYS_FRAME_HEADER 12
+#define SHARED_KEYS_FRAME_DATA 20
+
+// Without SHARED_KEYS_FRAME_DELTA, data holds count bytes of the shared-key
+// bitmap starting at byte offset, and replaces that range on the receiver. A
+// full snapshot of a large key space spans several frames. A frame only needs
+// its header and count bytes of data, so it fits in a 0xC5 batch.
+typedef struct __attribute__((packed)) {
+    uint8_t  command;
+    uint8_t  version;
+    uint8_t  sender;
+    uint8_t  flags;
+    uint16_t seq;
+    uint32_t timestamp; // sender's timer_read32() when the frame was built
+    uint8_t  count;
+    uint8_t  offset;
+    uint8_t  data[SHARED_KEYS_FRAME_DATA];
+} shared_keys_frame_t;
+
+enum shared_keys {
+    _SK_DRAG_SCROLL,
+    _SK_NUM,
+    _SK_FUN,
+    _SK_SYM,
+    _SK_NAV,
+    _SK_NVIM = 30,
+    _SK_NVIM_NORMAL,
+};
+
+void shared_key_event_local(uint8_t key, bool pressed);
+void process_shared_keys_remote(const uint32_t keys[SHARED_KEYS_WORDS]);
+void shared_keys_send(void);
+// Flushes buffered local changes and expires the remote state when heartbeats
+// stop, call once per scan from housekeeping_task_user.
+void shared_keys_task(void);
+// Raw HID handlers for 0xC0, 0xC1 and 0xC2.
+void shared_keys_receive_heartbeat(uint8_t *data, uint8_t length);
+void shared_keys_receive_remote(uint8_t *data, uint8_t length);
+void shared_keys_receive_frame(uint8_t *data, uint8_t length);
+bool shared_keys_host_connected(void);
+// Overrides HEARTBEAT_TIMEOUT_MS until the host disconnects, zero restores it.
+void shared_keys_set_heartbeat_timeout(uint16_t timeout_ms);
+
+// Called whenever the combined (local | remote) state of a shared key changes.
+// Weak, keymaps override it to act on the keys they care about.
+void shared_key_event(uint8_t key, bool pressed);
@@ -0,0 +1,142 @@
+#include "typing_stats.h"
+#include "quantum.h"
+#include "raw_hid_commands.h"
+#include "raw_hid_queue.h"
+#include "timer.h"
+#include "usb_descriptor.h"
+#include <assert.h>
+#include <string.h>
+
+#define SKETCH_WIDTH (1 << TYPING_STATS_SKETCH_BITS)
+#define KEY_COUNT (MATRIX_ROWS * MATRIX_COLS)
+
+static_assert(TYPING_STATS_SKETCH_DEPTH >= 1 && TYPING_STATS_SKETCH_DEPTH <= 8, "one seed per sketch row");
+static_assert(KEY_COUNT <= 255, "keys are numbered in a byte");
+
+__attribute__((weak)) const uint8_t typing_stats_fingers[MATRIX_ROWS][MATRIX_COLS] PROGMEM = {0};
+
+__attribute__((weak)) uint16_t typing_stats_magic_rule_count(void) {
+    return 0;
+}
+
+__attribute__((weak)) uint16_t typing_stats_magic_rule_line(uint16_t rule) {
+    return 0;
+}
+
+__attribute__((weak)) uint16_t typing_stats_magic_rule_hits(uint16_t rule) {
+    return 0;
+}
+
+__attribute__((weak)) void typing_stats_magic_reset(void) {}
+
+typedef struct {
+    typing_stats_header_t header;
+    uint16_t              sketch[TYPING_STATS_SKETCH_DEPTH][SKETCH_WIDTH];
+    uint16_t              presses[KEY_COUNT];
+    uint16_t              same_finger[KEY_COUNT];
+} typing_stats_t;
+
+// Sent as it is, so no padding.
+static_assert(sizeof(typing_stats_t) == sizeof(typing_stats_header_t) + (TYPING_STATS_SKETCH_DEPTH * SKETCH_WIDTH + 2 * KEY_COUNT) * sizeof(uint16_t), "typing_stats_t must be packed");
+static_assert(sizeof(typing_stats_t) <= 0x8000, "the block must fit the 16-bit offsets, magic rules included");
+
+static typing_stats_t stats;
+static uint32_t       stats_since = 0;
+
+// The previous base layer key, or none after anything else was typed.
+static uint8_t last_token = 0;
+static uint8_t last_key   = 0;
+
+static void count(uint16_t *counter) {
+    if (*counter < UINT16_MAX) {
+        (*counter)++;
+    }
+}
+
+void typing_stats_record(uint16_t keycode, keyrecord_t *record) {
+    if (!record->event.pressed) {
+        return;
+    }
+    if (IS_QK_MOD_TAP(keycode) || IS_QK_LAYER_TAP(keycode)) {
+        if (record->tap.count == 0) {
+            return; // held for its mod or layer
+        }
+        keycode = get_tap_keycode(keycode);
+    }
+    int8_t  repeat = get_repeat_key_count();
+    uint8_t token  = repeat > 0 ? TYPING_STATS_KEY_REPEAT : repeat < 0 ? TYPING_STATS_KEY_MAGIC : keycode;
+    if (repeat > 0) {
+        stats.header.repeat++;
+    } else if (repeat < 0) {
+        stats.header.magic++;
+    }
+    if (repeat == 0 && (keycode > QK_BASIC_MAX || IS_MODIFIER_KEYCODE(keycode) || keycode == KC_NO)) {
+        return; // layer keys and mods, which only change what comes next
+    }
+    if (get_highest_layer(layer_state | default_layer_state) != get_highest_layer(default_layer_state)) {
+        last_token = 0;
+        return;
+    }
+
+    uint8_t key = record->event.key.row * MATRIX_COLS + record->event.key.col;
+    count(&stats.presses[key]);
+    if (last_token != 0) {
+        uint16_t bigram = (last_token << 8) | token;
+        for (uint8_t row = 0; row < TYPING_STATS_SKETCH_DEPTH; row++) {
+            count(&stats.sketch[row][typing_stats_column(row, bigram, TYPING_STATS_SKETCH_BITS)]);
+        }
+        stats.header.bigrams++;
+        uint8_t finger = pgm_read_byte(&typing_stats_fingers[0][0] + key);
+        if (finger != 0 && key != last_key && finger == pgm_read_byte(&typing_stats_fingers[0][0] + last_key)) {
+            count(&stats.same_finger[key]);
+        }
+    }
+    last_token = token;
+    last_key   = key;
+}
+
+void typing_stats_reset(void) {
+    memset(&stats, 0, sizeof(stats));
+    stats_since = timer_read32();
+    last_token  = 0;
+    typing_stats_magic_reset();
+}
+
+// Byte of the block at offset; the magic rule tables follow stats.
+static uint8_t block_byte(uint16_t offset) {
+    if (offset < sizeof(stats)) {
+        return ((const uint8_t *)&stats)[offset];
+    }
+    offset -= sizeof(stats);
+    uint16_t rules = typing_stats_magic_rule_count();
+    uint16_t rule  = (offset / 2) % rules;
+    uint16_t value = offset / 2 < rules ? typing_stats_magic_rule_line(rule) : typing_stats_magic_rule_hits(rule);
+    return offset % 2 ? value >> 8 : value & 0xFF;
+}
+
+void typing_stats_receive(uint8_t *data, uint8_t length) {
+    uint16_t rules            = typing_stats_magic_rule_count();
+    stats.header.size         = sizeof(stats) + rules * 2 * sizeof(uint16_t);
+    stats.header.sketch_depth = TYPING_STATS_SKETCH_DEPTH;
+    stats.header.sketch_bits  = TYPING_STATS_SKETCH_BITS;
+    stats.header.matrix_rows  = MATRIX_ROWS;
+    stats.header.matrix_cols  = MATRIX_COLS;
+    stats.header.magic_rules  = rules;
+    stats.header.elapsed_ms   = timer_elapsed32(stats_since);
+
+    uint16_t offset = length >= 4 ? data[2] | (data[3] << 8) : 0;
+    uint8_t  frames = length >= 5 ? data[4] : 1;
+    for (; frames > 0 && offset < stats.header.size; frames--) {
+        uint8_t frame[RAW_EPSIZE] = {RAW_HID_CMD_TYPING_STATS, offset & 0xFF, offset >> 8};
+        uint8_t size              = stats.header.size - offset < RAW_EPSIZE - TYPING_STATS_FRAME_HEADER ? stats.header.size - offset : RAW_EPSIZE - TYPING_STATS_FRAME_HEADER;
+        frame[3]                  = size;
+        for (uint8_t i = 0; i < size; i++) {
+            frame[TYPING_STATS_FRAME_HEADER + i] = block_byte(offset + i);
+        }
+        raw_hid_queue_send(frame, RAW_EPSIZE);
+        offset += size;
+    }
+    if (length >= 2 && data[1]) {
+        typing_stats_reset();
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Typing statistics for tuning the magic rules, built with TYPING_STATS_ENABLE =
+// yes. Each key press costs a fixed handful of counter updates and the memory
+// is fixed at build time, so they can stay on. They cover:
+//   - bigrams of keys typed on the base layer, in a count-min sketch
+//   - same-finger bigrams, by the matrix position of the second key
+//   - how often each magic.rules line fired, when the keymap has magic rules
+// Counters saturate. The host reads the block a page at a time over raw HID:
+//     [0xC8, reset, offset lo, offset hi, frames] -> frames x [0xC8, offset lo, offset hi, size, size bytes of the block]
+// and the stats are reset after the frames are queued if reset is nonzero.
+
+// Sketch rows, each with 1 << TYPING_STATS_SKETCH_BITS counters.
+#ifndef TYPING_STATS_SKETCH_DEPTH
+#    define TYPING_STATS_SKETCH_DEPTH 4
+#endif
+#ifndef TYPING_STATS_SKETCH_BITS
+#    define TYPING_STATS_SKETCH_BITS 8
+#endif
+
+// A bigram is (first << 8) | second. Keys are their basic keycode, or these
+// for the repeat keys.
+#define TYPING_STATS_KEY_REPEAT 0xF0
+#define TYPING_STATS_KEY_MAGIC 0xF1
+
+// Multiply-shift hashing, one odd multiplier per row. Host tools hash the same
+// way to estimate a bigram: the smallest of its counters across the rows.
+#define TYPING_STATS_SEEDS {0x9E3779B1, 0x85EBCA77, 0xC2B2AE3D, 0x27D4EB2F, 0x165667B1, 0xD3A2646D, 0xFD7046C5, 0xB55A4F09}
+
+static inline uint16_t typing_stats_column(uint8_t row, uint16_t bigram, uint8_t bits) {
+    static const uint32_t seeds[] = TYPING_STATS_SEEDS;
+    return (uint32_t)((bigram + 1u) * seeds[row]) >> (32 - bits);
+}
+
+// Little-endian on the wire. The header is followed by
+//     uint16_t sketch[sketch_depth][1 << sketch_bits];
+//     uint16_t presses[matrix_rows * matrix_cols]; // base layer presses
+//     uint16_t same_finger[matrix_rows * matrix_cols];
+//     uint16_t magic_lines[magic_rules]; // magic.rules line of each rule
+//     uint16_t magic_hits[magic_rules];
+typedef struct __attribute__((packed)) {
+    uint16_t size; // of the whole block
+    uint8_t  sketch_depth;
+    uint8_t  sketch_bits;
+    uint8_t  matrix_rows;
+    uint8_t  matrix_cols;
+    uint16_t magic_rules;
+    uint32_t elapsed_ms; // since the last reset
+    uint32_t bigrams;    // added to the sketch
+    uint32_t magic;      // magic key presses
+    uint32_t repeat;     // repeat key presses
+} typing_stats_header_t;
+
+#define TYPING_STATS_FRAME_HEADER 4
+
+// Firmware side; host tools include this for the format only.
+#ifdef QMK_KEYBOARD_H
+#    include "action.h"
+
+// Finger of each key, 0 for keys left out of same-finger bigrams like the
+// thumbs. Keymaps override the weak default, which leaves every key out.
+extern const uint8_t typing_stats_fingers[MATRIX_ROWS][MATRIX_COLS];
+
+// Call from process_record_user.
+void typing_stats_record(uint16_t keycode, keyrecord_t *record);
+#endif
+
+void typing_stats_reset(void);
+// Handler for RAW_HID_CMD_TYPING_STATS.
+void typing_stats_receive(uint8_t *data, uint8_t length);
+
+// Magic rule hits, from magic.c; weak defaults for keymaps without magic rules.
+uint16_t typing_stats_magic_rule_count(void);
+uint16_t typing_stats_magic_rule_line(uint16_t rule);
+uint16_t typing_stats_magic_rule_hits(uint16_t rule);
+void     typing_stats_magic_reset(void);